@@ -0,0 +1,349 @@
+//===--------------------------------------------------------------------------------------------===
+// bcenc.c - Block compression of decoded images (BC1, BC4, BC7)
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "bcenc.h"
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The encoders favour speed over quality: endpoints are the extremes of the block along its
+// principal axis, and every texel picks the closest palette entry. BC7 only uses mode 6 (one subset,
+// RGBA endpoints with a p-bit each, 16 levels), which is the best single mode for photos.
+//
+// Blocks are worked on as 16-wide arrays per channel, so the inner loops vectorise.
+
+typedef struct {
+    float   c[4][16];   // texels, channel-major, 0-255
+} block_t;
+
+GLenum bcenc_parse(const char *name) {
+    if(!strcmp(name, "bc1")) return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    if(!strcmp(name, "bc4")) return GL_COMPRESSED_RED_RGTC1;
+    if(!strcmp(name, "bc7")) return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    return 0;
+}
+
+const char *bcenc_name(GLenum format) {
+    switch(format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return "BC1";
+    case GL_COMPRESSED_RED_RGTC1: return "BC4";
+    case GL_COMPRESSED_RGBA_BPTC_UNORM: return "BC7";
+    default: return NULL;
+    }
+}
+
+bool bcenc_supported(GLenum format) {
+    switch(format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        return gl_has_extension("GL_EXT_texture_compression_s3tc");
+    case GL_COMPRESSED_RED_RGTC1:
+        return true; // core since 3.0
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        return gl_has_extension("GL_ARB_texture_compression_bptc");
+    default:
+        return false;
+    }
+}
+
+bool bcenc_can_encode(const gl_image_t *image) {
+    assert(image);
+    return !gl_block_size(image->internal)
+        && (image->type == GL_UNSIGNED_BYTE || image->type == GL_UNSIGNED_SHORT);
+}
+
+bool bcenc_alloc(const gl_image_t *image, GLenum format, gl_image_t *out) {
+    assert(image && bcenc_can_encode(image));
+    assert(out);
+    assert(gl_block_size(format));
+
+    *out = (gl_image_t){
+        .width = image->width,
+        .height = image->height,
+        .components = format == GL_COMPRESSED_RED_RGTC1 ? 1 : format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 3 : 4,
+        .type = GL_UNSIGNED_BYTE,
+        .internal = format,
+        .levels = image->levels,
+    };
+    out->pixels = malloc(gl_image_size(out, out->levels));
+    return out->pixels != NULL;
+}
+
+int bcenc_rows(const gl_image_t *image, int level) {
+    int height;
+    gl_image_level(image, level, NULL, &height);
+    return (height + 3) / 4;
+}
+
+// Reads a block as RGBA, clamping to the edges of the level. Grey images are expanded to RGB, and
+// 16-bit channels keep their top byte.
+static void fetch_block(const gl_image_t *image, int level, int bx, int by, block_t *block) {
+    int width, height;
+    const uint8_t *pixels = gl_image_level(image, level, &width, &height);
+    int n = image->components;
+
+    for(int i = 0; i < 16; ++i) {
+        int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+        if(x >= width) x = width - 1;
+        if(y >= height) y = height - 1;
+
+        float v[4] = {0, 0, 0, 255};
+        size_t at = ((size_t)y * width + x) * n;
+        for(int c = 0; c < n; ++c) {
+            v[c] = image->type == GL_UNSIGNED_SHORT
+                ? (float)(((const uint16_t *)pixels)[at + c] >> 8)
+                : (float)pixels[at + c];
+        }
+        if(n <= 2) {
+            v[3] = n == 2 ? v[1] : 255;
+            v[1] = v[2] = v[0];
+        }
+        for(int c = 0; c < 4; ++c) block->c[c][i] = v[c];
+    }
+}
+
+// Finds the block's principal axis over its first `channels` channels, and returns the texels
+// projecting furthest along it in each direction.
+static void find_endpoints(const block_t *block, int channels, float lo[4], float hi[4]) {
+    float mean[4] = {0}, axis[4] = {0};
+    for(int c = 0; c < channels; ++c) {
+        float sum = 0.f, min = FLT_MAX, max = -FLT_MAX;
+        for(int i = 0; i < 16; ++i) {
+            sum += block->c[c][i];
+            min = block->c[c][i] < min ? block->c[c][i] : min;
+            max = block->c[c][i] > max ? block->c[c][i] : max;
+        }
+        mean[c] = sum / 16.f;
+        axis[c] = max - min;
+    }
+
+    float cov[4][4] = {{0}};
+    for(int a = 0; a < channels; ++a) {
+        for(int b = a; b < channels; ++b) {
+            float sum = 0.f;
+            for(int i = 0; i < 16; ++i) sum += (block->c[a][i] - mean[a]) * (block->c[b][i] - mean[b]);
+            cov[a][b] = cov[b][a] = sum;
+        }
+    }
+    // A few rounds of power iteration, starting from the bounding box's diagonal.
+    for(int round = 0; round < 4; ++round) {
+        float next[4] = {0}, length = 0.f;
+        for(int a = 0; a < channels; ++a) {
+            for(int b = 0; b < channels; ++b) next[a] += cov[a][b] * axis[b];
+            length = fabsf(next[a]) > length ? fabsf(next[a]) : length;
+        }
+        if(length <= 0.f) break;
+        for(int a = 0; a < channels; ++a) axis[a] = next[a] / length;
+    }
+
+    float t[16], min = FLT_MAX, max = -FLT_MAX;
+    for(int i = 0; i < 16; ++i) {
+        t[i] = 0.f;
+        for(int c = 0; c < channels; ++c) t[i] += (block->c[c][i] - mean[c]) * axis[c];
+    }
+    int imin = 0, imax = 0;
+    for(int i = 0; i < 16; ++i) {
+        if(t[i] < min) { min = t[i]; imin = i; }
+        if(t[i] > max) { max = t[i]; imax = i; }
+    }
+    for(int c = 0; c < 4; ++c) {
+        lo[c] = block->c[c][imin];
+        hi[c] = block->c[c][imax];
+    }
+}
+
+// Picks the closest of `count` palette entries for every texel.
+static void pick_indices(const block_t *block, int channels, const float palette[][4], int count, int indices[16]) {
+    float best[16];
+    for(int i = 0; i < 16; ++i) {
+        best[i] = FLT_MAX;
+        indices[i] = 0;
+    }
+    for(int k = 0; k < count; ++k) {
+        float dist[16] = {0};
+        for(int c = 0; c < channels; ++c) {
+            for(int i = 0; i < 16; ++i) {
+                float d = block->c[c][i] - palette[k][c];
+                dist[i] += d * d;
+            }
+        }
+        for(int i = 0; i < 16; ++i) {
+            indices[i] = dist[i] < best[i] ? k : indices[i];
+            best[i] = dist[i] < best[i] ? dist[i] : best[i];
+        }
+    }
+}
+
+static void put_le(uint8_t *out, uint64_t value, int bytes) {
+    for(int i = 0; i < bytes; ++i) out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint16_t pack_565(const float color[4]) {
+    int r = (int)(color[0] * 31.f / 255.f + .5f);
+    int g = (int)(color[1] * 63.f / 255.f + .5f);
+    int b = (int)(color[2] * 31.f / 255.f + .5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void unpack_565(uint16_t packed, float color[4]) {
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (float)((r << 3) | (r >> 2));
+    color[1] = (float)((g << 2) | (g >> 4));
+    color[2] = (float)((b << 3) | (b >> 2));
+    color[3] = 255.f;
+}
+
+static void encode_bc1(const block_t *block, uint8_t *out) {
+    float lo[4], hi[4];
+    find_endpoints(block, 3, lo, hi);
+    uint16_t c0 = pack_565(hi), c1 = pack_565(lo);
+    // c0 > c1 selects the four-colour mode. When they're equal, every texel is c0 anyway.
+    if(c0 < c1) {
+        uint16_t swap = c0;
+        c0 = c1;
+        c1 = swap;
+    }
+
+    uint32_t bits = 0;
+    if(c0 != c1) {
+        float palette[4][4];
+        unpack_565(c0, palette[0]);
+        unpack_565(c1, palette[1]);
+        for(int c = 0; c < 3; ++c) {
+            palette[2][c] = (2.f * palette[0][c] + palette[1][c]) / 3.f;
+            palette[3][c] = (palette[0][c] + 2.f * palette[1][c]) / 3.f;
+        }
+        int indices[16];
+        pick_indices(block, 3, (const float (*)[4])palette, 4, indices);
+        for(int i = 0; i < 16; ++i) bits |= (uint32_t)indices[i] << (2 * i);
+    }
+    put_le(out, c0, 2);
+    put_le(out + 2, c1, 2);
+    put_le(out + 4, bits, 4);
+}
+
+static void encode_bc4(const block_t *block, uint8_t *out) {
+    float min = 255.f, max = 0.f;
+    for(int i = 0; i < 16; ++i) {
+        min = block->c[0][i] < min ? block->c[0][i] : min;
+        max = block->c[0][i] > max ? block->c[0][i] : max;
+    }
+    int r0 = (int)(max + .5f), r1 = (int)(min + .5f);
+
+    uint64_t bits = 0;
+    if(r0 > r1) {
+        // r0 > r1 selects eight levels: r0, r1, then six evenly spaced between them.
+        float palette[8][4] = {{(float)r0}, {(float)r1}};
+        for(int k = 2; k < 8; ++k) palette[k][0] = (float)((8 - k) * r0 + (k - 1) * r1) / 7.f;
+        int indices[16];
+        pick_indices(block, 1, (const float (*)[4])palette, 8, indices);
+        for(int i = 0; i < 16; ++i) bits |= (uint64_t)indices[i] << (3 * i);
+    }
+    out[0] = (uint8_t)r0;
+    out[1] = (uint8_t)r1;
+    put_le(out + 2, bits, 6);
+}
+
+typedef struct {
+    uint8_t *out;
+    int     pos;
+} bits_t;
+
+static void put_bits(bits_t *bits, unsigned value, int count) {
+    for(int i = 0; i < count; ++i, ++bits->pos) {
+        if(value & (1u << i)) bits->out[bits->pos >> 3] |= (uint8_t)(1u << (bits->pos & 7));
+    }
+}
+
+// Quantises an endpoint to 7 bits per channel plus a shared p-bit, picking whichever p-bit is
+// closest.
+static void quantize_7p(const float color[4], int q[4], int *pbit) {
+    float best = FLT_MAX;
+    for(int p = 0; p < 2; ++p) {
+        int cand[4];
+        float error = 0.f;
+        for(int c = 0; c < 4; ++c) {
+            int v = (int)((color[c] - p) / 2.f + .5f);
+            cand[c] = v < 0 ? 0 : v > 127 ? 127 : v;
+            float d = (float)(cand[c] * 2 + p) - color[c];
+            error += d * d;
+        }
+        if(error < best) {
+            best = error;
+            *pbit = p;
+            memcpy(q, cand, sizeof(cand));
+        }
+    }
+}
+
+static void encode_bc7(const block_t *block, uint8_t *out) {
+    static const int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    float lo[4], hi[4];
+    find_endpoints(block, 4, lo, hi);
+    int q[2][4], p[2];
+    quantize_7p(lo, q[0], &p[0]);
+    quantize_7p(hi, q[1], &p[1]);
+
+    float palette[16][4];
+    for(int k = 0; k < 16; ++k) {
+        for(int c = 0; c < 4; ++c) {
+            int e0 = q[0][c] * 2 + p[0], e1 = q[1][c] * 2 + p[1];
+            palette[k][c] = (float)(((64 - weights[k]) * e0 + weights[k] * e1 + 32) >> 6);
+        }
+    }
+    int indices[16];
+    pick_indices(block, 4, (const float (*)[4])palette, 16, indices);
+
+    // The first texel's index is stored without its top bit, so it must be below 8: if it isn't,
+    // swap the endpoints, which mirrors every index.
+    int e0 = 0, e1 = 1;
+    if(indices[0] & 8) {
+        e0 = 1;
+        e1 = 0;
+        for(int i = 0; i < 16; ++i) indices[i] = 15 - indices[i];
+    }
+
+    memset(out, 0, 16);
+    bits_t bits = {out, 0};
+    put_bits(&bits, 1u << 6, 7); // mode 6
+    for(int c = 0; c < 4; ++c) {
+        put_bits(&bits, q[e0][c], 7);
+        put_bits(&bits, q[e1][c], 7);
+    }
+    put_bits(&bits, p[e0], 1);
+    put_bits(&bits, p[e1], 1);
+    put_bits(&bits, indices[0], 3);
+    for(int i = 1; i < 16; ++i) put_bits(&bits, indices[i], 4);
+    assert(bits.pos == 128);
+}
+
+void bcenc_encode(const gl_image_t *image, gl_image_t *out, int level, int first, int count) {
+    assert(image && out);
+    assert(level >= 0 && level < out->levels);
+    assert(first >= 0 && first + count <= bcenc_rows(image, level));
+
+    int width;
+    uint8_t *dst = gl_image_level(out, level, &width, NULL);
+    size_t block_size = gl_block_size(out->internal);
+    int columns = (width + 3) / 4;
+    dst += (size_t)first * columns * block_size;
+
+    block_t block;
+    for(int by = first; by < first + count; ++by) {
+        for(int bx = 0; bx < columns; ++bx, dst += block_size) {
+            fetch_block(image, level, bx, by, &block);
+            switch(out->internal) {
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: encode_bc1(&block, dst); break;
+            case GL_COMPRESSED_RED_RGTC1: encode_bc4(&block, dst); break;
+            default: encode_bc7(&block, dst); break;
+            }
+        }
+    }
+}
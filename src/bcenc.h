@@ -0,0 +1,38 @@
+//===--------------------------------------------------------------------------------------------===
+// bcenc.h - Block compression of decoded images (BC1, BC4, BC7)
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include "gl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns the GL format for a format name (bc1, bc4 or bc7), or 0 if there is no such format.
+GLenum bcenc_parse(const char *name);
+const char *bcenc_name(GLenum format);
+
+// Whether the driver can sample `format`. Must be called with a current context.
+bool bcenc_supported(GLenum format);
+
+// Whether `image` can be encoded: only 8 and 16-bit images can, HDR images would need BC6H.
+bool bcenc_can_encode(const gl_image_t *image);
+
+// Sets up `out` to receive every level of `image` compressed to `format`, and allocates its blocks.
+bool bcenc_alloc(const gl_image_t *image, GLenum format, gl_image_t *out);
+
+// Number of rows of blocks in one of the image's levels.
+int bcenc_rows(const gl_image_t *image, int level);
+
+// Encodes rows of blocks [first, first + count) of one level of `image` into `out`, which was set up
+// by bcenc_alloc(). Different rows can be encoded on different threads at the same time.
+void bcenc_encode(const gl_image_t *image, gl_image_t *out, int level, int first, int count);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
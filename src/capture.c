@@ -0,0 +1,360 @@
+//===--------------------------------------------------------------------------------------------===
+// capture.c - Asynchronous frame readback and raw video output
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "capture.h"
+#include "pngenc.h"
+#include "pool.h"
+#include "timer.h"
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// Frames in flight. Frame N is written out when frame N + CAPTURE_RING is queued, so its readback
+// overlaps rendering the two frames after it.
+#define CAPTURE_RING 3
+
+// Frames waiting for or being encoded, per encoder thread. When they're all taken, readback waits
+// for the encoders rather than buffer frames without bound.
+#define ENCODE_QUEUE 2
+
+struct capture_t {
+    FILE                *out;
+    char                *path;
+    capture_format_t    format;
+    int                 width;
+    int                 height;
+    size_t              frame_size;
+    
+    GLuint              pbo;
+    uint8_t             *mapped;    // persistent mapping, or NULL
+    GLsync              fences[CAPTURE_RING];
+    long                queued;
+    long                written;
+    
+    uint8_t             *planes;    // Y4M frames are converted here
+    bool                failed;
+    double              start;
+    double              wait_ms;
+    double              write_ms;
+    
+    // PNG frames are handed to a pool of encoders. Everything below is protected by `lock`.
+    pool_t              *encoders;
+    pthread_mutex_t     lock;
+    pthread_cond_t      done;
+    int                 in_flight;
+    int                 max_in_flight;
+    bool                encode_failed;
+    double              encode_wait_ms;
+};
+
+typedef struct {
+    capture_t           *capture;
+    uint8_t             *pixels;
+    long                frame;
+} encode_t;
+
+bool capture_parse(const char *name, capture_format_t *format) {
+    if(!strcmp(name, "rgba")) *format = CAPTURE_RGBA;
+    else if(!strcmp(name, "y4m")) *format = CAPTURE_Y4M;
+    else if(!strcmp(name, "png")) *format = CAPTURE_PNG;
+    else return false;
+    return true;
+}
+
+static bool write_all(capture_t *capture, const void *data, size_t size) {
+    if(capture->failed) return false;
+    if(fwrite(data, 1, size, capture->out) == size) return true;
+    fprintf(stderr, "capture: could not write to `%s`, dropping the remaining frames\n", capture->path);
+    capture->failed = true;
+    return false;
+}
+
+// Y4M frame rates are ratios. NTSC-style rates are written as multiples of 1000/1001.
+static void write_header(capture_t *capture, double fps) {
+    long num = lround(fps * 1000), den = 1000;
+    if(fabs(fps - round(fps)) < 1e-6) {
+        num = lround(fps);
+        den = 1;
+    } else if(fabs(fps * 1.001 - round(fps * 1.001)) < 1e-3) {
+        num = lround(fps * 1.001) * 1000;
+        den = 1001;
+    }
+    char header[128];
+    int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%ld:%ld Ip A1:1 C444 XCOLORRANGE=LIMITED\n",
+                          capture->width, capture->height, num, den);
+    write_all(capture, header, length);
+}
+
+// Sequence paths go through snprintf(), so they must have exactly one conversion, and it must be
+// a (possibly zero-padded) %d.
+static bool is_pattern(const char *path) {
+    int conversions = 0;
+    for(const char *p = path; *p; ++p) {
+        if(*p != '%') continue;
+        if(*++p == '%') continue;
+        while(*p >= '0' && *p <= '9') ++p;
+        if(*p != 'd') return false;
+        conversions += 1;
+    }
+    return conversions == 1;
+}
+
+// Creates the directory a sequence goes in, if there is one.
+static bool make_parent(const char *path) {
+    const char *slash = strrchr(path, '/');
+    if(!slash || slash == path) return true;
+    char dir[slash - path + 1];
+    memcpy(dir, path, slash - path);
+    dir[slash - path] = '\0';
+    return make_dirs(dir);
+}
+
+static bool open_output(capture_t *capture, const char *path, int threads) {
+    if(capture->format == CAPTURE_PNG) {
+        if(!is_pattern(path)) {
+            fprintf(stderr, "PNG sequence path `%s` needs a single %%d for the frame number\n", path);
+            return false;
+        }
+        if(!make_parent(path)) {
+            fprintf(stderr, "could not create the directory for `%s`\n", path);
+            return false;
+        }
+        capture->encoders = pool_new(threads);
+        if(!capture->encoders) {
+            fprintf(stderr, "could not start PNG encoders\n");
+            return false;
+        }
+        pthread_mutex_init(&capture->lock, NULL);
+        pthread_cond_init(&capture->done, NULL);
+        capture->max_in_flight = ENCODE_QUEUE * pool_size(capture->encoders);
+        capture->path = strdup(path);
+        return true;
+    }
+    
+    bool to_stdout = !strcmp(path, "-");
+    capture->out = to_stdout ? stdout : fopen(path, "wb");
+    if(!capture->out) {
+        fprintf(stderr, "could not open `%s` for writing\n", path);
+        return false;
+    }
+    // A reader that goes away should be a write error we report, not a signal that kills us.
+    signal(SIGPIPE, SIG_IGN);
+    capture->path = strdup(to_stdout ? "stdout" : path);
+    return true;
+}
+
+capture_t *capture_new(const char *path, capture_format_t format, int width, int height, double fps,
+                       int threads)
+{
+    assert(path);
+    assert(width > 0 && height > 0);
+    
+    capture_t *capture = calloc(1, sizeof(capture_t));
+    capture->format = format;
+    if(!open_output(capture, path, threads)) {
+        free(capture);
+        return NULL;
+    }
+    capture->width = width;
+    capture->height = height;
+    capture->frame_size = (size_t)width * height * 4;
+    if(format == CAPTURE_Y4M) {
+        capture->planes = malloc((size_t)width * height * 3);
+        write_header(capture, fps);
+    }
+    
+    GLsizeiptr size = (GLsizeiptr)(CAPTURE_RING * capture->frame_size);
+    void *mapped = NULL;
+    capture->pbo = gl_create_stream_buffer(GL_PIXEL_PACK_BUFFER, size, GL_MAP_READ_BIT, &mapped);
+    capture->mapped = mapped;
+    
+    if(format == CAPTURE_RGBA) {
+        fprintf(stderr, "capture: writing raw RGBA to `%s`; read it with "
+                "ffmpeg -f rawvideo -pix_fmt rgba -s %dx%d -r %g -i <file>\n",
+                capture->path, width, height, fps);
+    } else if(format == CAPTURE_Y4M) {
+        fprintf(stderr, "capture: writing Y4M to `%s`\n", capture->path);
+    } else {
+        fprintf(stderr, "capture: writing PNG frames to `%s` on %d encoder thread%s\n",
+                capture->path, pool_size(capture->encoders), pool_size(capture->encoders) == 1 ? "" : "s");
+    }
+    capture->start = timer_now();
+    return capture;
+}
+
+// BT.601 limited range, in 8-bit fixed point. GL reads rows bottom-up, video is top-down.
+static void write_y4m(capture_t *capture, const uint8_t *pixels) {
+    int width = capture->width, height = capture->height;
+    size_t plane = (size_t)width * height;
+    uint8_t *y_plane = capture->planes;
+    uint8_t *u_plane = y_plane + plane;
+    uint8_t *v_plane = u_plane + plane;
+    
+    for(int y = 0; y < height; ++y) {
+        const uint8_t *row = pixels + (size_t)(height - 1 - y) * width * 4;
+        size_t at = (size_t)y * width;
+        for(int x = 0; x < width; ++x) {
+            int r = row[x * 4 + 0], g = row[x * 4 + 1], b = row[x * 4 + 2];
+            y_plane[at + x] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            u_plane[at + x] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            v_plane[at + x] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+    static const char frame[] = "FRAME\n";
+    if(write_all(capture, frame, sizeof(frame) - 1)) write_all(capture, capture->planes, plane * 3);
+}
+
+static void encode_job(void *arg) {
+    encode_t *job = arg;
+    capture_t *capture = job->capture;
+    
+    // The pattern was checked when the capture was set up.
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), capture->path, job->frame);
+    bool ok = png_write(path, job->pixels, capture->width, capture->height);
+    free(job->pixels);
+    free(job);
+    
+    pthread_mutex_lock(&capture->lock);
+    capture->in_flight -= 1;
+    if(!ok) capture->encode_failed = true;
+    pthread_cond_signal(&capture->done);
+    pthread_mutex_unlock(&capture->lock);
+}
+
+// Copies the frame out of the readback buffer, top row first, and queues it for encoding once an
+// encoder is free.
+static void write_png(capture_t *capture, const uint8_t *pixels) {
+    double start = timer_now();
+    pthread_mutex_lock(&capture->lock);
+    while(capture->in_flight == capture->max_in_flight) {
+        pthread_cond_wait(&capture->done, &capture->lock);
+    }
+    capture->in_flight += 1;
+    if(capture->encode_failed) capture->failed = true;
+    pthread_mutex_unlock(&capture->lock);
+    capture->encode_wait_ms += (timer_now() - start) * 1e3;
+    
+    size_t pitch = (size_t)capture->width * 4;
+    encode_t *job = malloc(sizeof(encode_t));
+    job->capture = capture;
+    job->frame = capture->written;
+    job->pixels = malloc(capture->frame_size);
+    for(int y = 0; y < capture->height; ++y) {
+        memcpy(job->pixels + (size_t)y * pitch, pixels + (size_t)(capture->height - 1 - y) * pitch, pitch);
+    }
+    pool_submit(capture->encoders, encode_job, job);
+}
+
+static void write_rgba(capture_t *capture, const uint8_t *pixels) {
+    size_t pitch = (size_t)capture->width * 4;
+    for(int y = capture->height - 1; y >= 0; --y) {
+        if(!write_all(capture, pixels + (size_t)y * pitch, pitch)) return;
+    }
+}
+
+// Writes out the oldest frame in flight. Returns false if its readback isn't complete and we
+// shouldn't wait for it.
+static bool write_oldest(capture_t *capture, bool wait) {
+    int slot = capture->written % CAPTURE_RING;
+    
+    double start = timer_now();
+    if(!gl_wait_fence(&capture->fences[slot], wait)) return false;
+    
+    double ready = timer_now();
+    capture->wait_ms += (ready - start) * 1e3;
+    
+    size_t offset = slot * capture->frame_size;
+    const uint8_t *pixels = capture->mapped ? capture->mapped + offset : NULL;
+    if(!pixels) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbo);
+        pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, offset, capture->frame_size, GL_MAP_READ_BIT);
+        if(!pixels) die("could not map capture buffer");
+    }
+    if(capture->format == CAPTURE_Y4M) write_y4m(capture, pixels);
+    else if(capture->format == CAPTURE_PNG) write_png(capture, pixels);
+    else write_rgba(capture, pixels);
+    if(!capture->mapped) {
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    
+    capture->written += 1;
+    capture->write_ms += (timer_now() - ready) * 1e3;
+    return true;
+}
+
+bool capture_frame(capture_t *capture, GLuint fbo) {
+    assert(capture);
+    
+    // Write whatever is ready already, then make room if the GPU is that far behind.
+    while(capture->written < capture->queued && write_oldest(capture, false)) {}
+    if(capture->queued - capture->written == CAPTURE_RING) write_oldest(capture, true);
+    
+    int slot = capture->queued % CAPTURE_RING;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, capture->width, capture->height, GL_RGBA, GL_UNSIGNED_BYTE,
+                 (void *)(slot * capture->frame_size));
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    capture->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    capture->queued += 1;
+    return !capture->failed;
+}
+
+bool capture_delete(capture_t *capture) {
+    if(!capture) return true;
+    
+    while(capture->written < capture->queued) write_oldest(capture, true);
+    gl_delete_stream_buffer(GL_PIXEL_PACK_BUFFER, capture->pbo, capture->mapped);
+    
+    bool ok = !capture->failed;
+    if(capture->encoders) {
+        // Whatever is still encoding now is time we spend waiting on the encoders.
+        double start = timer_now();
+        pool_delete(capture->encoders);
+        capture->encode_wait_ms += (timer_now() - start) * 1e3;
+        ok = !capture->encode_failed && ok;
+        pthread_cond_destroy(&capture->done);
+        pthread_mutex_destroy(&capture->lock);
+    } else if(capture->out == stdout) {
+        ok = !fflush(stdout) && ok;
+    } else {
+        ok = !fclose(capture->out) && ok;
+    }
+    
+    if(ok) {
+        double elapsed = timer_now() - capture->start;
+        fprintf(stderr, "captured %ld frame%s (%dx%d) to `%s` in %.2f s (%.1f fps): "
+                "%.1f ms waiting on readback, %.1f ms writing",
+                capture->written, capture->written == 1 ? "" : "s", capture->width, capture->height,
+                capture->path, elapsed, elapsed > 0 ? capture->written / elapsed : 0.0,
+                capture->wait_ms, capture->write_ms);
+        if(capture->encoders) {
+            // Time spent blocked on an encoder or on the GPU's readback; whatever is left went into
+            // submitting frames, copying them out of the mapping and handing them to the encoders.
+            double encoder_bound = 100 * capture->encode_wait_ms / (elapsed * 1e3);
+            double gpu_bound = 100 * capture->wait_ms / (elapsed * 1e3);
+            fprintf(stderr, "\ncapture: %.1f ms waiting on encoders; %.0f%% of the run encoder-bound, "
+                    "%.0f%% GPU-bound, %.0f%% rendering and copying\n", capture->encode_wait_ms,
+                    encoder_bound, gpu_bound, 100 - encoder_bound - gpu_bound);
+        } else {
+            fprintf(stderr, "\n");
+        }
+    }
+    free(capture->planes);
+    free(capture->path);
+    free(capture);
+    return ok;
+}
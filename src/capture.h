@@ -0,0 +1,47 @@
+//===--------------------------------------------------------------------------------------------===
+// capture.h - Asynchronous frame readback and raw video output
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include "gl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    CAPTURE_RGBA,   // raw 8-bit RGBA frames, top row first
+    CAPTURE_Y4M,    // YUV4MPEG2, 4:4:4 BT.601 limited range
+    CAPTURE_PNG,    // numbered RGB PNG files
+} capture_format_t;
+
+typedef struct capture_t capture_t;
+
+// Returns the format for a format name (rgba, y4m or png), or false if there is no such format.
+bool capture_parse(const char *name, capture_format_t *format);
+
+// Starts writing `width`x`height` frames to `path` (`-` for stdout). `fps` only goes in the Y4M
+// header. Returns NULL if the file can't be opened.
+//
+// PNG frames go to separate files: `path` is a pattern with a single %d (e.g. `out/%04d.png`) that
+// receives the frame number, counting from 0. They are encoded on a pool of `threads` workers (0
+// for one per CPU); the files are the same whatever the number of threads.
+capture_t *capture_new(const char *path, capture_format_t format, int width, int height, double fps,
+                       int threads);
+
+// Writes out the remaining frames, closes the output and prints a summary. Returns false if any
+// write failed.
+bool capture_delete(capture_t *capture);
+
+// Queues the readback of `fbo` into the next buffer of the ring, and writes out earlier frames whose
+// readback has completed. Only blocks when the ring is full, on the oldest frame. Changes the read
+// framebuffer binding.
+bool capture_frame(capture_t *capture, GLuint fbo);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,423 @@
+//===--------------------------------------------------------------------------------------------===
+// compiler.c - Background shader program builds
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "compiler.h"
+#include "hash.h"
+#include "timer.h"
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// GL_KHR_parallel_shader_compile isn't in our glad profile.
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR  0x91B0
+#define GL_COMPLETION_STATUS_KHR            0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// Compiled shader objects kept around for reuse. The vertex shader never changes, so it stays in
+// for good; the others are whatever fragment shaders were built last.
+#define SHADER_CACHE_SIZE   8
+
+typedef struct {
+    uint64_t            key;
+    GLuint              shader;
+    unsigned            last_use;
+} cached_shader_t;
+
+// One program being built, and what it cost so far.
+typedef struct {
+    GLuint              prog;
+    GLuint              vert;
+    GLuint              frag;
+    uint64_t            vert_key;
+    uint64_t            frag_key;
+    build_times_t       times;
+} build_t;
+
+struct compiler_t {
+    build_state_t       state;
+    bool                parallel;
+    double              start;
+    
+    // In-flight build for synchronous and parallel builds, and the result of worker builds.
+    build_t             build;
+    
+    // Only ever used by the thread that compiles: the worker when there is one.
+    cached_shader_t     cache[SHADER_CACHE_SIZE];
+    unsigned            uses;
+    
+    // Worker thread builds. Everything below is protected by `lock`.
+    void                *context;
+    make_current_fn     make_current;
+    bool                has_thread;
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    bool                started;    // the worker tried to make its context current
+    bool                has_context;
+    char                *job_vert;
+    char                *job_frag;
+    uint64_t            job_vert_key;
+    uint64_t            job_frag_key;
+    bool                job_retrievable;
+    bool                job_ready;
+    bool                quit;
+    build_state_t       worker_state;
+    build_t             worker_build;
+};
+
+static size_t piece_length(const GLint *lengths, const char **sources, int i) {
+    return lengths && lengths[i] >= 0 ? (size_t)lengths[i] : strlen(sources[i]);
+}
+
+// Shader objects are keyed by their stage and the hash of their concatenated sources.
+static uint64_t source_key(GLenum type, const char **sources, const GLint *lengths, int count) {
+    uint64_t key = hash_bytes(HASH_INIT, &type, sizeof(type));
+    for(int i = 0; i < count; ++i) {
+        size_t length = piece_length(lengths, sources, i);
+        key = hash_words(key, sources[i], length);
+        key = hash_bytes(key, &length, sizeof(length));
+    }
+    return key;
+}
+
+// The worker builds after compiler_start() returns, so it needs its own copy of the sources.
+static char *join(const char **sources, const GLint *lengths, int count) {
+    size_t len = 0;
+    for(int i = 0; i < count; ++i) len += piece_length(lengths, sources, i);
+    
+    char *str = calloc(len + 1, sizeof(char));
+    char *p = str;
+    for(int i = 0; i < count; ++i) {
+        size_t n = piece_length(lengths, sources, i);
+        memcpy(p, sources[i], n);
+        p += n;
+    }
+    return str;
+}
+
+static GLuint lookup(compiler_t *compiler, uint64_t key) {
+    for(int i = 0; i < SHADER_CACHE_SIZE; ++i) {
+        cached_shader_t *entry = &compiler->cache[i];
+        if(!entry->shader || entry->key != key) continue;
+        entry->last_use = ++compiler->uses;
+        return entry->shader;
+    }
+    return 0;
+}
+
+static void insert(compiler_t *compiler, uint64_t key, GLuint shader) {
+    cached_shader_t *slot = &compiler->cache[0];
+    for(int i = 0; i < SHADER_CACHE_SIZE; ++i) {
+        cached_shader_t *entry = &compiler->cache[i];
+        if(!entry->shader) {
+            slot = entry;
+            break;
+        }
+        if(entry->last_use < slot->last_use) slot = entry;
+    }
+    // Programs the evicted shader was linked into keep working without it.
+    if(slot->shader) glDeleteShader(slot->shader);
+    *slot = (cached_shader_t){key, shader, ++compiler->uses};
+}
+
+// Returns the cached shader object for `key`, or starts compiling a new one.
+static GLuint stage(compiler_t *compiler, GLenum type, uint64_t key,
+                    const char **sources, const GLint *lengths, int count, bool *cached)
+{
+    GLuint sh = lookup(compiler, key);
+    *cached = sh != 0;
+    if(sh) return sh;
+    
+    sh = glCreateShader(type);
+    glShaderSource(sh, count, sources, lengths);
+    glCompileShader(sh);
+    return sh;
+}
+
+static GLuint link(GLuint vert, GLuint frag, bool retrievable) {
+    GLuint prog = glCreateProgram();
+    if(retrievable) glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glAttachShader(prog, vert);
+    glAttachShader(prog, frag);
+    glLinkProgram(prog);
+    return prog;
+}
+
+// Starts both stages, reusing cached shader objects, and links them. With `timed`, waits for each
+// step to finish before starting the next, so that their costs can be told apart.
+static void start_build(compiler_t *compiler, build_t *build,
+                        const char **vert, const GLint *vert_lengths, int vert_count,
+                        const char **frag, const GLint *frag_lengths, int frag_count,
+                        bool retrievable, bool timed)
+{
+    GLint status = 0;
+    double start = timer_now();
+    build->vert = stage(compiler, GL_VERTEX_SHADER, build->vert_key, vert, vert_lengths, vert_count,
+                        &build->times.vert_cached);
+    if(timed && !build->times.vert_cached) glGetShaderiv(build->vert, GL_COMPILE_STATUS, &status);
+    
+    double vert_done = timer_now();
+    build->frag = stage(compiler, GL_FRAGMENT_SHADER, build->frag_key, frag, frag_lengths, frag_count,
+                        &build->times.frag_cached);
+    if(timed && !build->times.frag_cached) glGetShaderiv(build->frag, GL_COMPILE_STATUS, &status);
+    
+    double frag_done = timer_now();
+    build->prog = link(build->vert, build->frag, retrievable);
+    if(timed) {
+        glGetProgramiv(build->prog, GL_LINK_STATUS, &status);
+        build->times.vert_ms = (vert_done - start) * 1e3;
+        build->times.frag_ms = (frag_done - vert_done) * 1e3;
+        build->times.link_ms = (timer_now() - frag_done) * 1e3;
+    }
+}
+
+// Checks compile and link status once everything is known to be complete. Prints the relevant logs,
+// caches the shader objects that compiled, and returns the program or 0 on failure.
+static GLuint finish(compiler_t *compiler, build_t *build) {
+    GLuint prog = build->prog;
+    GLint status = GL_FALSE;
+    glGetProgramiv(prog, GL_LINK_STATUS, &status);
+    if(status != GL_TRUE) {
+        // Shader logs are more useful than "link failed", so show those first.
+        if(gl_check_shader(build->vert) && gl_check_shader(build->frag)) gl_check_program(prog);
+        glDeleteProgram(prog);
+        prog = 0;
+    } else {
+        glDetachShader(prog, build->vert);
+        glDetachShader(prog, build->frag);
+    }
+    
+    const GLuint shaders[] = {build->vert, build->frag};
+    const uint64_t keys[] = {build->vert_key, build->frag_key};
+    const bool cached[] = {build->times.vert_cached, build->times.frag_cached};
+    for(int i = 0; i < 2; ++i) {
+        if(cached[i]) continue;
+        glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &status);
+        if(status == GL_TRUE) insert(compiler, keys[i], shaders[i]);
+        else glDeleteShader(shaders[i]);
+    }
+    build->prog = build->vert = build->frag = 0;
+    return prog;
+}
+
+static void *worker_main(void *arg) {
+    compiler_t *compiler = arg;
+    bool has_context = compiler->make_current(compiler->context, true);
+    
+    // compiler_new() waits to hear whether we can build at all, and builds on its own if not.
+    pthread_mutex_lock(&compiler->lock);
+    compiler->started = true;
+    compiler->has_context = has_context;
+    pthread_cond_broadcast(&compiler->cond);
+    if(!has_context) {
+        pthread_mutex_unlock(&compiler->lock);
+        return NULL;
+    }
+    
+    for(;;) {
+        while(!compiler->job_ready && !compiler->quit) {
+            pthread_cond_wait(&compiler->cond, &compiler->lock);
+        }
+        if(compiler->quit) break;
+        
+        char *vert_src = compiler->job_vert;
+        char *frag_src = compiler->job_frag;
+        build_t build = {
+            .vert_key = compiler->job_vert_key,
+            .frag_key = compiler->job_frag_key,
+        };
+        bool retrievable = compiler->job_retrievable;
+        compiler->job_vert = compiler->job_frag = NULL;
+        compiler->job_ready = false;
+        pthread_mutex_unlock(&compiler->lock);
+        
+        start_build(compiler, &build, (const char **)&vert_src, NULL, 1,
+                    (const char **)&frag_src, NULL, 1, retrievable, true);
+        GLuint prog = finish(compiler, &build);
+        // The program is only guaranteed to be visible to the render context once the commands
+        // that created it have completed.
+        glFinish();
+        free(vert_src);
+        free(frag_src);
+        
+        pthread_mutex_lock(&compiler->lock);
+        build.prog = prog;
+        compiler->worker_build = build;
+        compiler->worker_state = prog ? BUILD_DONE : BUILD_FAILED;
+        pthread_cond_broadcast(&compiler->cond);
+    }
+    pthread_mutex_unlock(&compiler->lock);
+    
+    for(int i = 0; i < SHADER_CACHE_SIZE; ++i) {
+        if(compiler->cache[i].shader) glDeleteShader(compiler->cache[i].shader);
+    }
+    compiler->make_current(compiler->context, false);
+    return NULL;
+}
+
+compiler_t *compiler_new(void *worker_context, make_current_fn make_current) {
+    compiler_t *compiler = calloc(1, sizeof(*compiler));
+    compiler->state = BUILD_IDLE;
+    
+    if(gl_has_extension("GL_KHR_parallel_shader_compile")) {
+        PFNGLMAXSHADERCOMPILERTHREADSKHRPROC max_threads =
+            (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)gl_get_proc("glMaxShaderCompilerThreadsKHR");
+        if(max_threads) max_threads(0xffffffffu);
+        compiler->parallel = true;
+        fprintf(stderr, "compiler: using GL_KHR_parallel_shader_compile\n");
+        return compiler;
+    }
+    
+    if(!worker_context || !make_current) return compiler;
+    
+    pthread_mutex_init(&compiler->lock, NULL);
+    pthread_cond_init(&compiler->cond, NULL);
+    compiler->context = worker_context;
+    compiler->make_current = make_current;
+    compiler->worker_state = BUILD_IDLE;
+    if(pthread_create(&compiler->thread, NULL, worker_main, compiler)) {
+        fprintf(stderr, "compiler: could not start worker thread\n");
+        pthread_cond_destroy(&compiler->cond);
+        pthread_mutex_destroy(&compiler->lock);
+        return compiler;
+    }
+    
+    pthread_mutex_lock(&compiler->lock);
+    while(!compiler->started) pthread_cond_wait(&compiler->cond, &compiler->lock);
+    pthread_mutex_unlock(&compiler->lock);
+    if(!compiler->has_context) {
+        // Every build would fail without a word, so build on the render thread instead.
+        fprintf(stderr, "compiler: could not make worker context current, building synchronously\n");
+        pthread_join(compiler->thread, NULL);
+        pthread_cond_destroy(&compiler->cond);
+        pthread_mutex_destroy(&compiler->lock);
+        return compiler;
+    }
+    compiler->has_thread = true;
+    fprintf(stderr, "compiler: using a shared context on a worker thread\n");
+    return compiler;
+}
+
+void compiler_delete(compiler_t *compiler) {
+    if(!compiler) return;
+    
+    if(compiler->has_thread) {
+        // The worker releases its own cached shaders before it exits.
+        pthread_mutex_lock(&compiler->lock);
+        compiler->quit = true;
+        pthread_cond_broadcast(&compiler->cond);
+        pthread_mutex_unlock(&compiler->lock);
+        pthread_join(compiler->thread, NULL);
+        
+        free(compiler->job_vert);
+        free(compiler->job_frag);
+        if(compiler->worker_build.prog) glDeleteProgram(compiler->worker_build.prog);
+        pthread_cond_destroy(&compiler->cond);
+        pthread_mutex_destroy(&compiler->lock);
+    } else {
+        // A build still in flight holds shaders that aren't in the cache yet.
+        if(compiler->state == BUILD_RUNNING) compiler_poll(compiler, true);
+        for(int i = 0; i < SHADER_CACHE_SIZE; ++i) {
+            if(compiler->cache[i].shader) glDeleteShader(compiler->cache[i].shader);
+        }
+    }
+    
+    if(compiler->build.prog) glDeleteProgram(compiler->build.prog);
+    free(compiler);
+}
+
+bool compiler_start(compiler_t *compiler,
+                    const char **vert, const GLint *vert_lengths, int vert_count,
+                    const char **frag, const GLint *frag_lengths, int frag_count,
+                    bool retrievable)
+{
+    assert(compiler);
+    if(compiler->state == BUILD_RUNNING) return false;
+    
+    // Drop any finished result that nobody took.
+    if(compiler->state != BUILD_IDLE) compiler_take(compiler, NULL);
+    
+    compiler->start = timer_now();
+    compiler->state = BUILD_RUNNING;
+    uint64_t vert_key = source_key(GL_VERTEX_SHADER, vert, vert_lengths, vert_count);
+    uint64_t frag_key = source_key(GL_FRAGMENT_SHADER, frag, frag_lengths, frag_count);
+    
+    if(compiler->has_thread) {
+        pthread_mutex_lock(&compiler->lock);
+        compiler->job_vert = join(vert, vert_lengths, vert_count);
+        compiler->job_frag = join(frag, frag_lengths, frag_count);
+        compiler->job_vert_key = vert_key;
+        compiler->job_frag_key = frag_key;
+        compiler->job_retrievable = retrievable;
+        compiler->job_ready = true;
+        compiler->worker_state = BUILD_RUNNING;
+        pthread_cond_broadcast(&compiler->cond);
+        pthread_mutex_unlock(&compiler->lock);
+        return true;
+    }
+    
+    // With the parallel extension these calls return immediately and the driver works in the
+    // background. Without it, they block, and the build is done by the time we return. Either way,
+    // GL copies the pieces before glShaderSource() returns, so they're handed over as they are.
+    compiler->build = (build_t){.vert_key = vert_key, .frag_key = frag_key};
+    if(compiler->parallel) {
+        // The driver overlaps the steps in the background, so only the whole build can be timed.
+        build_times_t *times = &compiler->build.times;
+        times->vert_ms = times->frag_ms = times->link_ms = NAN;
+    }
+    start_build(compiler, &compiler->build, vert, vert_lengths, vert_count,
+                frag, frag_lengths, frag_count, retrievable, !compiler->parallel);
+    return true;
+}
+
+build_state_t compiler_poll(compiler_t *compiler, bool wait) {
+    assert(compiler);
+    if(compiler->state != BUILD_RUNNING) return compiler->state;
+    
+    if(compiler->has_thread) {
+        pthread_mutex_lock(&compiler->lock);
+        while(wait && compiler->worker_state == BUILD_RUNNING) {
+            pthread_cond_wait(&compiler->cond, &compiler->lock);
+        }
+        if(compiler->worker_state != BUILD_RUNNING) {
+            compiler->build = compiler->worker_build;
+            compiler->worker_build = (build_t){0};
+            compiler->state = compiler->worker_state;
+            compiler->worker_state = BUILD_IDLE;
+        }
+        pthread_mutex_unlock(&compiler->lock);
+    } else {
+        if(compiler->parallel && !wait) {
+            GLint complete = GL_FALSE;
+            glGetProgramiv(compiler->build.prog, GL_COMPLETION_STATUS_KHR, &complete);
+            if(!complete) return BUILD_RUNNING;
+        }
+        compiler->build.prog = finish(compiler, &compiler->build);
+        compiler->state = compiler->build.prog ? BUILD_DONE : BUILD_FAILED;
+    }
+    
+    if(compiler->state != BUILD_RUNNING) {
+        compiler->build.times.total_ms = (timer_now() - compiler->start) * 1e3;
+    }
+    return compiler->state;
+}
+
+GLuint compiler_take(compiler_t *compiler, build_times_t *times) {
+    assert(compiler);
+    assert(compiler->state != BUILD_RUNNING);
+    
+    GLuint prog = compiler->state == BUILD_DONE ? compiler->build.prog : 0;
+    if(!prog && compiler->build.prog) glDeleteProgram(compiler->build.prog);
+    if(times) *times = compiler->build.times;
+    compiler->build.prog = 0;
+    compiler->state = BUILD_IDLE;
+    return prog;
+}
@@ -0,0 +1,68 @@
+//===--------------------------------------------------------------------------------------------===
+// compiler.h - Background shader program builds
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include "gl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    BUILD_IDLE,
+    BUILD_RUNNING,
+    BUILD_DONE,
+    BUILD_FAILED,
+} build_state_t;
+
+// Makes a worker context current on the calling thread (or releases it when `current` is false).
+typedef bool (*make_current_fn)(void *context, bool current);
+
+typedef struct compiler_t compiler_t;
+
+// Where the time went in a build. Stages whose shader object was reused from an earlier build are
+// flagged as cached, and cost nothing. With GL_KHR_parallel_shader_compile, the driver overlaps the
+// steps, so only the total is known and the step times are NAN.
+typedef struct {
+    double              total_ms;
+    double              vert_ms;
+    double              frag_ms;
+    double              link_ms;
+    bool                vert_cached;
+    bool                frag_cached;
+} build_times_t;
+
+// Creates a compiler for the current context. Builds use GL_KHR_parallel_shader_compile when the
+// driver has it. Otherwise, when `worker_context` is given (a context sharing objects with the
+// current one), they run on a separate thread that makes it current through `make_current`. With
+// neither, builds are synchronous.
+compiler_t *compiler_new(void *worker_context, make_current_fn make_current);
+void compiler_delete(compiler_t *compiler);
+
+// Starts building a program from the concatenation of `vert` and `frag` sources. Lengths work like
+// glShaderSource()'s: NULL (or a negative length) means a piece is nul-terminated. The pieces can
+// be released as soon as this returns. Returns false if a build is already running. With
+// `retrievable`, the program can be saved with glGetProgramBinary.
+//
+// Compiled shader objects are kept, keyed by the hash of their sources, so a stage whose source was
+// already compiled (the vertex shader, always) is only linked again.
+bool compiler_start(compiler_t *compiler,
+                    const char **vert, const GLint *vert_lengths, int vert_count,
+                    const char **frag, const GLint *frag_lengths, int frag_count,
+                    bool retrievable);
+
+// Checks on the current build without blocking, unless `wait` is set.
+build_state_t compiler_poll(compiler_t *compiler, bool wait);
+
+// Takes ownership of the program once the build is BUILD_DONE, and resets the compiler to idle.
+// Returns 0 (and resets) when the build failed. `times` receives what the build cost.
+GLuint compiler_take(compiler_t *compiler, build_times_t *times);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
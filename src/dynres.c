@@ -0,0 +1,65 @@
+//===--------------------------------------------------------------------------------------------===
+// dynres.c - Dynamic resolution controller
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "dynres.h"
+#include <assert.h>
+#include <math.h>
+
+#define DYNRES_SMOOTHING    0.2     // weight of each new sample in the running average
+#define DYNRES_SETTLE       8       // samples needed before acting on a new scale
+#define DYNRES_TARGET       0.9     // aim a little under budget, so noise doesn't push us over
+#define DYNRES_HEADROOM     0.75    // only scale back up when well under budget
+#define DYNRES_MAX_DOWN     0.75
+#define DYNRES_MAX_UP       1.15
+#define DYNRES_STEP         64.f    // scales are multiples of 1/64, so tiny changes don't thrash
+
+void dynres_init(dynres_t *dynres, double budget_ms, float min_scale, float max_scale) {
+    assert(dynres);
+    assert(budget_ms > 0);
+    assert(min_scale > 0 && min_scale <= max_scale);
+    dynres->budget_ms = budget_ms;
+    dynres->min_scale = min_scale;
+    dynres->max_scale = max_scale;
+    dynres->scale = max_scale;
+    dynres->avg_ms = 0;
+    dynres->samples = 0;
+    dynres->since = 0;
+}
+
+bool dynres_update(dynres_t *dynres, long frame, double frame_ms, long next_frame) {
+    assert(dynres);
+    if(frame < dynres->since || isnan(frame_ms)) return false;
+    
+    dynres->avg_ms = dynres->samples
+        ? dynres->avg_ms + DYNRES_SMOOTHING * (frame_ms - dynres->avg_ms)
+        : frame_ms;
+    dynres->samples += 1;
+    if(dynres->samples < DYNRES_SETTLE) return false;
+    
+    double avg = dynres->avg_ms;
+    if(avg <= dynres->budget_ms && avg >= dynres->budget_ms * DYNRES_HEADROOM) return false;
+    if(avg > dynres->budget_ms && dynres->scale <= dynres->min_scale) return false;
+    if(avg < dynres->budget_ms && dynres->scale >= dynres->max_scale) return false;
+    
+    // Fragment cost goes with the number of pixels, which goes with the square of the scale.
+    double factor = avg > 0 ? sqrt(dynres->budget_ms * DYNRES_TARGET / avg) : DYNRES_MAX_UP;
+    if(factor < DYNRES_MAX_DOWN) factor = DYNRES_MAX_DOWN;
+    if(factor > DYNRES_MAX_UP) factor = DYNRES_MAX_UP;
+    
+    // Round away from the current scale, so that we always move in the direction we meant to.
+    float step = dynres->scale * factor * DYNRES_STEP;
+    float scale = (factor > 1 ? ceilf(step) : floorf(step)) / DYNRES_STEP;
+    if(scale < dynres->min_scale) scale = dynres->min_scale;
+    if(scale > dynres->max_scale) scale = dynres->max_scale;
+    if(scale == dynres->scale) return false;
+    
+    dynres->scale = scale;
+    dynres->samples = 0;
+    dynres->since = next_frame;
+    return true;
+}
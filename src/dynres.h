@@ -0,0 +1,36 @@
+//===--------------------------------------------------------------------------------------------===
+// dynres.h - Dynamic resolution controller
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    double      budget_ms;
+    float       min_scale;
+    float       max_scale;
+    
+    float       scale;      // fraction of the window's width and height currently rendered
+    double      avg_ms;     // smoothed GPU frame time at the current scale
+    int         samples;    // samples averaged since the last change
+    long        since;      // first frame rendered at the current scale
+} dynres_t;
+
+void dynres_init(dynres_t *dynres, double budget_ms, float min_scale, float max_scale);
+
+// Feeds the GPU time of `frame` to the controller. Samples from frames rendered before the last
+// change are ignored. Returns true when the scale changed, in which case the new scale applies from
+// `next_frame` on.
+bool dynres_update(dynres_t *dynres, long frame, double frame_ms, long next_frame);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
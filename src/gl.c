@@ -4,12 +4,50 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 _Noreturn void die(const char *msg) {
     fprintf(stderr, "fatal error: %s\n", msg);
     abort();
 }
 
+static GLADloadproc gl_loader = NULL;
+
+typedef void (APIENTRYP tex_storage_fn)(GLenum target, GLsizei levels, GLenum internal, GLsizei width, GLsizei height);
+static tex_storage_fn gl_tex_storage_2d = NULL;
+
+typedef void (APIENTRYP buffer_storage_fn)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+static buffer_storage_fn gl_buffer_storage = NULL;
+
+bool gl_init(GLADloadproc loader) {
+    assert(loader);
+    gl_loader = loader;
+    if(!gladLoadGLLoader(loader)) return false;
+    
+    // Core in 4.2, which glad doesn't go up to.
+    if(gl_has_extension("GL_ARB_texture_storage")) gl_tex_storage_2d = gl_get_proc("glTexStorage2D");
+    if(gl_has_extension("GL_ARB_buffer_storage")) gl_buffer_storage = gl_get_proc("glBufferStorage");
+    return true;
+}
+
+void *gl_get_proc(const char *name) {
+    assert(gl_loader);
+    return gl_loader(name);
+}
+
+bool gl_has_extension(const char *name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for(GLint i = 0; i < count; ++i) {
+        const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if(ext && !strcmp(ext, name)) return true;
+    }
+    return false;
+}
+
 bool gl_check_shader(GLuint sh) {
     GLint is_compiled = 0;
     glGetShaderiv(sh, GL_COMPILE_STATUS, &is_compiled);
@@ -65,6 +103,20 @@ GLuint gl_create_program(const char *vertex, const char *fragment) {
     return prog;
 }
 
+bool make_dirs(const char *path) {
+    size_t len = strlen(path);
+    char buffer[len + 1];
+    memcpy(buffer, path, len + 1);
+    
+    for(char *p = buffer + 1; *p; ++p) {
+        if(*p != '/') continue;
+        *p = '\0';
+        if(mkdir(buffer, 0755) && errno != EEXIST) return false;
+        *p = '/';
+    }
+    return !mkdir(buffer, 0755) || errno == EEXIST;
+}
+
 char *load_source(const char *path) {
     assert(path);
     
@@ -143,13 +195,139 @@ GLuint gl_load_shader(GLenum type, ...) {
 }
 
 GLuint gl_create_tex(unsigned width, unsigned height) {
-    assert(width > 0);
-    assert(height > 0);
+    const gl_image_t image = {
+        .width = width,
+        .height = height,
+        .components = 4,
+        .type = GL_UNSIGNED_BYTE,
+        .internal = GL_RGBA8,
+        .levels = 1,
+    };
+    return gl_alloc_tex(&image, 1);
+}
+
+int gl_mip_levels(unsigned width, unsigned height) {
+    int levels = 1;
+    while(width > 1 || height > 1) {
+        width >>= 1;
+        height >>= 1;
+        levels += 1;
+    }
+    return levels;
+}
+
+void gl_tex_storage(GLenum internal, GLenum format, GLenum type, unsigned width, unsigned height, int levels) {
+    assert(levels > 0);
+    if(gl_tex_storage_2d) {
+        gl_tex_storage_2d(GL_TEXTURE_2D, levels, internal, width, height);
+        return;
+    }
+    
+    // Without immutable storage, spell out every level, and tell GL not to look for more.
+    size_t block = gl_block_size(internal);
+    for(int level = 0; level < levels; ++level) {
+        unsigned w = width >> level, h = height >> level;
+        w = w ? w : 1;
+        h = h ? h : 1;
+        if(block) {
+            GLsizei size = (GLsizei)(((w + 3) / 4) * ((h + 3) / 4) * block);
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, internal, w, h, 0, size, NULL);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, level, internal, w, h, 0, format, type, NULL);
+        }
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+}
+
+GLenum gl_image_format(const gl_image_t *image) {
+    assert(image);
+    static const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+    assert(image->components >= 1 && image->components <= 4);
+    return formats[image->components - 1];
+}
+
+static size_t texel_size(const gl_image_t *image) {
+    size_t size = image->type == GL_FLOAT ? 4 : image->type == GL_UNSIGNED_SHORT ? 2 : 1;
+    return size * image->components;
+}
+
+size_t gl_block_size(GLenum internal) {
+    switch(internal) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RED_RGTC1:
+        return 8;
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+size_t gl_image_pitch(const gl_image_t *image) {
+    assert(image);
+    size_t block = gl_block_size(image->internal);
+    if(block) return (size_t)((image->width + 3) / 4) * block;
+    return (size_t)image->width * texel_size(image);
+}
+
+size_t gl_image_size(const gl_image_t *image, int levels) {
+    assert(image);
+    size_t block = gl_block_size(image->internal);
+    size_t size = 0;
+    for(int level = 0; level < levels; ++level) {
+        size_t w = image->width >> level, h = image->height >> level;
+        w = w ? w : 1;
+        h = h ? h : 1;
+        size += block ? ((w + 3) / 4) * ((h + 3) / 4) * block : w * h * texel_size(image);
+    }
+    return size;
+}
+
+uint8_t *gl_image_level(const gl_image_t *image, int level, int *width, int *height) {
+    assert(image);
+    assert(level >= 0 && level < image->levels);
+    int w = image->width >> level, h = image->height >> level;
+    if(width) *width = w ? w : 1;
+    if(height) *height = h ? h : 1;
+    return image->pixels + gl_image_size(image, level);
+}
+
+GLuint gl_alloc_tex(const gl_image_t *image, int levels) {
+    assert(image);
+    assert(image->width > 0);
+    assert(image->height > 0);
+    if(!levels) levels = gl_mip_levels(image->width, image->height);
     
     GLuint tex = 0;
     glGenTextures(1, &tex);
     glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    GLenum format = gl_image_format(image);
+    gl_tex_storage(image->internal, format, image->type, image->width, image->height, levels);
+    if(image->pixels) {
+        // Decoded rows are tightly packed, which RGB rows often aren't by GL's default 4-byte rule.
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        int provided = image->levels < levels ? image->levels : levels;
+        for(int level = 0; level < provided; ++level) {
+            int w, h;
+            const uint8_t *pixels = gl_image_level(image, level, &w, &h);
+            if(gl_block_size(image->internal)) {
+                GLsizei size = (GLsizei)(gl_image_size(image, level + 1) - gl_image_size(image, level));
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, image->internal, size, pixels);
+            } else {
+                glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, format, image->type, pixels);
+            }
+        }
+        if(levels > provided) glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    
+    // Grey images are stored in one or two channels, and read back as .rrr with alpha from .g.
+    if(image->components == 1) {
+        static const GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    } else if(image->components == 2) {
+        static const GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_GREEN};
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -159,34 +337,184 @@ GLuint gl_create_tex(unsigned width, unsigned height) {
     return tex;
 }
 
-GLuint gl_load_tex(const char *path, int *w, int *h) {
-    // stbi_set_flip_vertically_on_load(true);
-    int components = 0;
-    uint8_t *data = stbi_load(path, w, h, &components, 0);
-    if(!data) {
-        fprintf(stderr, "unable to load image `%s`\n", path);
+GLuint gl_create_fbo(GLuint tex) {
+    assert(tex);
+    
+    GLuint fbo = 0;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+    
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if(status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "framebuffer incomplete (0x%04x)\n", status);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &fbo);
         return 0;
     }
-    if(components != 4 && components != 3) {
-        fprintf(stderr, "image `%s` does not have the right format\n", path);
-        free(data);
-        return 0;
+    return fbo;
+}
+
+GLuint gl_create_stream_buffer(GLenum target, GLsizeiptr size, GLbitfield access, void **mapped) {
+    assert(access == GL_MAP_READ_BIT || access == GL_MAP_WRITE_BIT);
+    assert(mapped);
+    *mapped = NULL;
+    
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(target, buffer);
+    if(gl_buffer_storage) {
+        GLbitfield flags = access | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        gl_buffer_storage(target, size, NULL, flags);
+        *mapped = glMapBufferRange(target, 0, size, flags);
+    }
+    if(!*mapped) {
+        if(gl_buffer_storage) {
+            // Immutable storage can't be respecified, so start over with a plain buffer.
+            glBindBuffer(target, 0);
+            glDeleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glBindBuffer(target, buffer);
+        }
+        glBufferData(target, size, NULL, access == GL_MAP_READ_BIT ? GL_STREAM_READ : GL_STREAM_DRAW);
     }
+    glBindBuffer(target, 0);
+    return buffer;
+}
 
-    GLuint tex = gl_create_tex(*w, *h);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    if(components == 4) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, *w, *h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+void gl_delete_stream_buffer(GLenum target, GLuint buffer, void *mapped) {
+    if(mapped) {
+        glBindBuffer(target, buffer);
+        glUnmapBuffer(target);
+        glBindBuffer(target, 0);
+    }
+    glDeleteBuffers(1, &buffer);
+}
+
+bool gl_wait_fence(GLsync *fence, bool wait) {
+    assert(fence);
+    if(!*fence) return true;
+    
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for(;;) {
+        GLenum status = glClientWaitSync(*fence, flags, wait ? 1000000000 : 0);
+        if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) break;
+        if(status == GL_WAIT_FAILED || !wait) return false;
+        flags = 0;
+    }
+    glDeleteSync(*fence);
+    *fence = NULL;
+    return true;
+}
+
+// Radiance images can't be negative, so as long as they stay in R11F_G11F_B10F's range, they
+// only need 4 bytes per texel rather than RGB16F's 6.
+static bool fits_packed_float(const float *pixels, size_t count) {
+    for(size_t i = 0; i < count; ++i) {
+        if(!(pixels[i] >= 0.f && pixels[i] <= 64000.f)) return false;
+    }
+    return true;
+}
+
+bool gl_decode_image(const char *path, gl_image_t *image) {
+    assert(image);
+    // stbi_set_flip_vertically_on_load(true);
+    int *w = &image->width, *h = &image->height, *c = &image->components;
+    if(stbi_is_hdr(path)) {
+        image->pixels = (uint8_t *)stbi_loadf(path, w, h, c, 0);
+        image->type = GL_FLOAT;
+    } else if(stbi_is_16_bit(path)) {
+        image->pixels = (uint8_t *)stbi_load_16(path, w, h, c, 0);
+        image->type = GL_UNSIGNED_SHORT;
     } else {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, *w, *h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+        image->pixels = stbi_load(path, w, h, c, 0);
+        image->type = GL_UNSIGNED_BYTE;
+    }
+    image->levels = 1;
+    image->mapping = NULL;
+    if(!image->pixels) {
+        fprintf(stderr, "unable to load image `%s`\n", path);
+        return false;
+    }
+    if(*c < 1 || *c > 4) {
+        fprintf(stderr, "image `%s` does not have the right format\n", path);
+        gl_free_image(image);
+        return false;
     }
     
-    free(data);
+    static const GLenum unorm8[] = {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+    static const GLenum unorm16[] = {GL_R16, GL_RG16, GL_RGB16, GL_RGBA16};
+    static const GLenum half[] = {GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F};
+    switch(image->type) {
+    case GL_FLOAT:
+        image->internal = half[*c - 1];
+        if(*c == 3 && fits_packed_float((const float *)image->pixels, (size_t)*w * *h * 3)) {
+            image->internal = GL_R11F_G11F_B10F;
+        }
+        break;
+    case GL_UNSIGNED_SHORT:
+        image->internal = unorm16[*c - 1];
+        break;
+    default:
+        image->internal = unorm8[*c - 1];
+        break;
+    }
+    return true;
+}
 
-    fprintf(stderr, "loaded texture `%s` (%dx%d)\n", path, *w, *h);
-    return tex;
+void gl_free_image(gl_image_t *image) {
+    assert(image);
+    if(image->mapping) munmap(image->mapping, image->mapping_size);
+    else stbi_image_free(image->pixels);
+    image->pixels = NULL;
+    image->mapping = NULL;
+}
+
+// Averages 2x2 blocks of `src` into `dst`. Odd edges reuse their last row or column.
+#define DOWNSAMPLE(T, ROUND)                                                                        \
+    for(int y = 0; y < dh; ++y) {                                                                   \
+        const T *r0 = (const T *)src + (size_t)(2*y < sh ? 2*y : sh-1) * sw * c;                   \
+        const T *r1 = (const T *)src + (size_t)(2*y+1 < sh ? 2*y+1 : sh-1) * sw * c;               \
+        T *out = (T *)dst + (size_t)y * dw * c;                                                     \
+        for(int x = 0; x < dw; ++x) {                                                               \
+            int x0 = 2*x < sw ? 2*x : sw-1, x1 = 2*x+1 < sw ? 2*x+1 : sw-1;                         \
+            for(int i = 0; i < c; ++i) {                                                            \
+                out[x*c + i] = (T)((r0[x0*c + i] + r0[x1*c + i] + r1[x0*c + i] + r1[x1*c + i]       \
+                                    + ROUND) / 4);                                                  \
+            }                                                                                       \
+        }                                                                                           \
+    }
+
+bool gl_build_mips(gl_image_t *image) {
+    assert(image && image->pixels);
+    assert(!image->mapping);
+    assert(!gl_block_size(image->internal));
+    int levels = gl_mip_levels(image->width, image->height);
+    if(image->levels >= levels) return true;
+    
+    uint8_t *pixels = malloc(gl_image_size(image, levels));
+    if(!pixels) return false;
+    memcpy(pixels, image->pixels, gl_image_size(image, image->levels));
+    stbi_image_free(image->pixels);
+    image->pixels = pixels;
+    
+    int c = image->components;
+    for(int level = image->levels; level < levels; ++level) {
+        image->levels = level + 1;
+        int sw, sh, dw, dh;
+        const uint8_t *src = gl_image_level(image, level - 1, &sw, &sh);
+        uint8_t *dst = gl_image_level(image, level, &dw, &dh);
+        switch(image->type) {
+        case GL_FLOAT:          DOWNSAMPLE(float, 0.f); break;
+        case GL_UNSIGNED_SHORT: DOWNSAMPLE(uint16_t, 2u); break;
+        default:                DOWNSAMPLE(uint8_t, 2u); break;
+        }
+    }
+    return true;
 }
 
+#undef DOWNSAMPLE
+
 void gl_ortho(float proj[16], float x, float y, float width, float height) {
     assert(proj);
     // float x_max = (x+width) -1;
@@ -11,6 +11,8 @@
 #include "math.h"
 #include <GLFW/glfw3.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <math.h>
 
 #if IBM
@@ -41,19 +43,94 @@ extern "C" {
 } /* extern "C" */
 #endif
 
+// Block-compressed formats newer than the GL version glad was generated for.
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT     0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM       0x8E8C
+#endif
+
+// Buffer storage flags, core in 4.4.
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT               0x0040
+#define GL_MAP_COHERENT_BIT                 0x0080
+#endif
+
 void die(const char *msg);
 
+// Loads the GL entry points, and keeps `loader` around for extension functions glad doesn't know.
+bool gl_init(GLADloadproc loader);
+void *gl_get_proc(const char *name);
+bool gl_has_extension(const char *name);
+
 GLuint gl_create_program(const char *vertex, const char *fragment);
 bool gl_check_program(GLuint sh);
 bool gl_check_shader(GLuint sh);
 
+// Creates `path` and any missing parent directories.
+bool make_dirs(const char *path);
+
 char *load_source(const char *path);
 char *load_sourcef(const char *fmt, ...);
 
 GLuint gl_load_shader(GLenum type, ...);
 
-GLuint gl_load_tex(const char *path, int *w, int *h);
+typedef struct {
+    uint8_t     *pixels;
+    int         width;
+    int         height;
+    int         components;
+    GLenum      type;       // GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_FLOAT
+    GLenum      internal;   // storage format picked by the decoder, or a block-compressed format
+    int         levels;     // mip levels stored back to back in `pixels`, largest first
+    
+    void        *mapping;   // when the pixels live in a mapped file rather than on the heap
+    size_t      mapping_size;
+} gl_image_t;
+
+GLenum gl_image_format(const gl_image_t *image);
+// Bytes per row of texels, or per row of 4x4 blocks for compressed images.
+size_t gl_image_pitch(const gl_image_t *image);
+// Bytes per 4x4 block of a compressed format, 0 for anything else.
+size_t gl_block_size(GLenum internal);
+
+// Returns the pixels of one of the image's levels, and its size.
+uint8_t *gl_image_level(const gl_image_t *image, int level, int *width, int *height);
+// Size in bytes of the image's first `levels` levels.
+size_t gl_image_size(const gl_image_t *image, int levels);
+
+// Decodes an image file, keeping its channel count and depth: 8-bit, 16-bit or, for Radiance files,
+// float. Doesn't touch GL, so it's safe on any thread.
+bool gl_decode_image(const char *path, gl_image_t *image);
+void gl_free_image(gl_image_t *image);
+// Fills in the rest of the image's mip chain on the CPU, with a box filter.
+bool gl_build_mips(gl_image_t *image);
+
 GLuint gl_create_tex(unsigned width, unsigned height);
+// Number of levels in a full mip chain.
+int gl_mip_levels(unsigned width, unsigned height);
+
+// Allocates `levels` levels for the texture bound to GL_TEXTURE_2D, immutably when the driver can.
+// `format` and `type` are only used by the mutable fallback.
+void gl_tex_storage(GLenum internal, GLenum format, GLenum type, unsigned width, unsigned height, int levels);
+
+// Creates a texture for `image` with `levels` levels (0 for a full chain), and fills it from the
+// image's pixels unless they're NULL. Levels the image doesn't have are generated.
+GLuint gl_alloc_tex(const gl_image_t *image, int levels);
+// Creates a framebuffer drawing to `tex`, and leaves it bound. Returns 0 if it's incomplete.
+GLuint gl_create_fbo(GLuint tex);
+
+// Creates a buffer of `size` bytes to stream through `target`: pixel transfers one way, as `access`
+// says (GL_MAP_READ_BIT or GL_MAP_WRITE_BIT). With ARB_buffer_storage, it's mapped persistently and
+// coherently for good, and `*mapped` points at the mapping. Otherwise `*mapped` is NULL, and ranges
+// have to be mapped as they're used.
+GLuint gl_create_stream_buffer(GLenum target, GLsizeiptr size, GLbitfield access, void **mapped);
+void gl_delete_stream_buffer(GLenum target, GLuint buffer, void *mapped);
+// Deletes `*fence` once it's signalled, and clears it; a NULL fence counts as signalled. Returns
+// false if it isn't and we shouldn't wait.
+bool gl_wait_fence(GLsync *fence, bool wait);
+
 void gl_ortho(float proj[16], float x, float y, float width, float height);
 
 void check_gl(const char *where, int line);
@@ -0,0 +1,181 @@
+//===--------------------------------------------------------------------------------------------===
+// graph.c - Multipass render graph and render target pool
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "graph.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+bool graph_sort(graph_t *graph) {
+    assert(graph);
+    assert(graph->count > 0 && graph->count <= GRAPH_MAX_PASSES);
+    
+    // Kahn's algorithm over the buffer passes. Self-references read the previous frame, so they
+    // aren't dependencies. Nothing can read the screen pass, and it always goes last.
+    int buffers = graph->count - 1;
+    int pending[GRAPH_MAX_PASSES] = {0};
+    bool placed[GRAPH_MAX_PASSES] = {false};
+    
+    for(int i = 0; i < graph->count; ++i) {
+        graph_pass_t *pass = &graph->passes[i];
+        pass->feedback = false;
+        pass->last_read = -1;
+        for(int j = 0; j < GRAPH_MAX_INPUTS; ++j) {
+            const graph_input_t *in = &pass->inputs[j];
+            if(in->kind != INPUT_PASS) continue;
+            assert(in->index >= 0 && in->index < buffers);
+            if(in->index == i) pass->feedback = true;
+            else pending[i] += 1;
+        }
+    }
+    
+    int count = 0;
+    while(count < buffers) {
+        int next = -1;
+        for(int i = 0; i < buffers; ++i) {
+            if(!placed[i] && !pending[i]) {
+                next = i;
+                break;
+            }
+        }
+        if(next < 0) return false;
+        
+        placed[next] = true;
+        graph->order[count++] = next;
+        for(int i = 0; i < graph->count; ++i) {
+            for(int j = 0; j < GRAPH_MAX_INPUTS; ++j) {
+                const graph_input_t *in = &graph->passes[i].inputs[j];
+                if(in->kind == INPUT_PASS && in->index == next && i != next) pending[i] -= 1;
+            }
+        }
+    }
+    graph->order[count] = graph->count - 1;
+    
+    for(int pos = 0; pos < graph->count; ++pos) {
+        const graph_pass_t *pass = &graph->passes[graph->order[pos]];
+        for(int j = 0; j < GRAPH_MAX_INPUTS; ++j) {
+            const graph_input_t *in = &pass->inputs[j];
+            if(in->kind == INPUT_PASS) graph->passes[in->index].last_read = pos;
+        }
+    }
+    return true;
+}
+
+static graph_target_t *acquire(graph_t *graph) {
+    for(int i = 0; i < graph->num_targets; ++i) {
+        if(!graph->targets[i].in_use) {
+            graph->targets[i].in_use = true;
+            return &graph->targets[i];
+        }
+    }
+    
+    // Each pass holds at most two targets, so the pool can't run out.
+    assert(graph->num_targets < GRAPH_MAX_TARGETS);
+    graph_target_t *target = &graph->targets[graph->num_targets++];
+    
+    glGenTextures(1, &target->tex);
+    glBindTexture(GL_TEXTURE_2D, target->tex);
+    gl_tex_storage(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, graph->width, graph->height, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    
+    target->fbo = gl_create_fbo(target->tex);
+    if(!target->fbo) die("could not create render target");
+    
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    target->in_use = true;
+    fprintf(stderr, "render target %d created (%dx%d)\n", graph->num_targets, graph->width, graph->height);
+    return target;
+}
+
+static void release(graph_target_t **target) {
+    if(!*target) return;
+    (*target)->in_use = false;
+    *target = NULL;
+}
+
+void graph_resize(graph_t *graph, int width, int height) {
+    assert(graph);
+    graph_fini(graph);
+    graph->width = width;
+    graph->height = height;
+}
+
+void graph_fini(graph_t *graph) {
+    assert(graph);
+    for(int i = 0; i < graph->num_targets; ++i) {
+        glDeleteFramebuffers(1, &graph->targets[i].fbo);
+        glDeleteTextures(1, &graph->targets[i].tex);
+    }
+    memset(graph->targets, 0, sizeof(graph->targets));
+    graph->num_targets = 0;
+    
+    for(int i = 0; i < graph->count; ++i) {
+        graph->passes[i].output = NULL;
+        graph->passes[i].back = NULL;
+    }
+}
+
+bool graph_prepare_pass(graph_t *graph, int index) {
+    assert(graph);
+    assert(index >= 0 && index < graph->count - 1);
+    graph_pass_t *pass = &graph->passes[index];
+    int num_targets = graph->num_targets;
+    
+    if(!pass->output) pass->output = acquire(graph);
+    if(pass->feedback && !pass->back) pass->back = acquire(graph);
+    if(!pass->feedback) release(&pass->back);
+    return graph->num_targets != num_targets;
+}
+
+GLuint graph_output(const graph_t *graph, int index) {
+    assert(graph);
+    assert(index >= 0 && index < graph->count);
+    const graph_target_t *target = graph->passes[index].output;
+    return target ? target->tex : 0;
+}
+
+GLuint graph_pass_fbo(const graph_t *graph, int index) {
+    assert(graph);
+    const graph_pass_t *pass = &graph->passes[index];
+    // Feedback passes read their previous output while rendering the next one into the back buffer.
+    const graph_target_t *target = pass->feedback ? pass->back : pass->output;
+    assert(target);
+    return target->fbo;
+}
+
+void graph_finish_pass(graph_t *graph, int position) {
+    assert(graph);
+    assert(position >= 0 && position < graph->count);
+    int index = graph->order[position];
+    graph_pass_t *pass = &graph->passes[index];
+    
+    if(pass->feedback && pass->back) {
+        graph_target_t *tmp = pass->output;
+        pass->output = pass->back;
+        pass->back = tmp;
+    }
+    
+    for(int j = 0; j < GRAPH_MAX_INPUTS; ++j) {
+        const graph_input_t *in = &pass->inputs[j];
+        if(in->kind != INPUT_PASS || in->index == index) continue;
+        graph_pass_t *source = &graph->passes[in->index];
+        if(source->persistent || source->last_read != position) continue;
+        release(&source->output);
+        release(&source->back);
+    }
+    
+    // A buffer nobody reads doesn't need to outlive its own pass.
+    if(index != graph->count - 1 && pass->last_read < 0 && !pass->persistent) {
+        release(&pass->output);
+        release(&pass->back);
+    }
+}
@@ -0,0 +1,89 @@
+//===--------------------------------------------------------------------------------------------===
+// graph.h - Multipass render graph and render target pool
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include "gl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GRAPH_MAX_PASSES    8
+#define GRAPH_MAX_INPUTS    4
+#define GRAPH_MAX_TARGETS   (2 * GRAPH_MAX_PASSES)
+
+typedef enum {
+    INPUT_NONE,
+    INPUT_IMAGE,
+    INPUT_PASS,
+} input_kind_t;
+
+typedef struct {
+    input_kind_t    kind;
+    int             index;
+} graph_input_t;
+
+typedef struct {
+    GLuint          tex;
+    GLuint          fbo;
+    bool            in_use;
+} graph_target_t;
+
+typedef struct {
+    graph_input_t   inputs[GRAPH_MAX_INPUTS];
+    
+    // Set by graph_sort().
+    bool            feedback;   // samples its own output from the previous frame
+    int             last_read;  // position in the order of the last pass reading this one
+    
+    // Passes that keep their output from one frame to the next (feedback, or passes that may be
+    // skipped when nothing changed) hold on to their targets. Others give them back to the pool
+    // as soon as the last pass reading them is done.
+    bool            persistent;
+    graph_target_t  *output;
+    graph_target_t  *back;      // second buffer for feedback passes
+} graph_pass_t;
+
+// The last pass is the one that renders to the screen. All the others render into float targets
+// the size of the screen.
+typedef struct {
+    graph_pass_t    passes[GRAPH_MAX_PASSES];
+    int             count;
+    int             order[GRAPH_MAX_PASSES];
+    
+    graph_target_t  targets[GRAPH_MAX_TARGETS];
+    int             num_targets;
+    int             width;
+    int             height;
+} graph_t;
+
+// Orders passes so that each one runs after the passes it reads from, and works out feedback and
+// target lifetimes. Returns false if passes depend on each other in a cycle.
+bool graph_sort(graph_t *graph);
+
+// Releases every render target. Targets are re-created at the new size as passes need them.
+void graph_resize(graph_t *graph, int width, int height);
+void graph_fini(graph_t *graph);
+
+// Gets the targets a pass renders into ready before it runs. Returns true if new targets had to be
+// created, which changes the current framebuffer and texture bindings.
+bool graph_prepare_pass(graph_t *graph, int pass);
+
+// Framebuffer a prepared pass renders into.
+GLuint graph_pass_fbo(const graph_t *graph, int pass);
+
+// Texture holding the latest output of a pass, or 0 if it hasn't rendered since the last resize.
+GLuint graph_output(const graph_t *graph, int pass);
+
+// Called after a pass has rendered: flips feedback buffers, and returns the targets of passes that
+// aren't read by anything later in the frame.
+void graph_finish_pass(graph_t *graph, int position);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,48 @@
+//===--------------------------------------------------------------------------------------------===
+// hash.h - Content hashing for caches
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#ifndef _SHADES_HASH_H_
+#define _SHADES_HASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// 64-bit FNV-1a. Not cryptographic, but plenty to tell two versions of a file apart.
+#define HASH_INIT   0xcbf29ce484222325ull
+
+static inline uint64_t hash_bytes(uint64_t hash, const void *data, size_t length) {
+    const uint8_t *bytes = data;
+    for(size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Same idea eight bytes at a time, for large buffers where hashing every byte would be too slow.
+// Gives different results from hash_bytes().
+static inline uint64_t hash_words(uint64_t hash, const void *data, size_t length) {
+    const uint8_t *bytes = data;
+    size_t words = length / 8;
+    for(size_t i = 0; i < words; ++i) {
+        uint64_t word;
+        memcpy(&word, bytes + i * 8, 8);
+        hash ^= word;
+        hash *= 0x100000001b3ull;
+        hash ^= hash >> 32;
+    }
+    return hash_bytes(hash, bytes + words * 8, length - words * 8);
+}
+
+static inline uint64_t hash_str(uint64_t hash, const char *str) {
+    // Hash the terminator too, so ("ab", "c") and ("a", "bc") don't collide.
+    return str ? hash_bytes(hash, str, strlen(str) + 1) : hash_bytes(hash, "", 1);
+}
+
+#endif /* ifndef _SHADES_HASH_H_ */
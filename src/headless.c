@@ -0,0 +1,138 @@
+//===--------------------------------------------------------------------------------------------===
+// headless.c - Window-less OpenGL contexts for offscreen rendering
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "headless.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if SHADES_HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+struct headless_t {
+    EGLDisplay  display;
+    EGLContext  context;
+};
+
+static bool has_extension(const char *list, const char *name) {
+    if(!list) return false;
+    size_t len = strlen(name);
+    for(const char *p = strstr(list, name); p; p = strstr(p + len, name)) {
+        if((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return true;
+    }
+    return false;
+}
+
+// We prefer Mesa's surfaceless platform: it doesn't need X11, Wayland or a DRM device, so it works
+// on CI boxes with nothing but llvmpipe. Anything else gets the default display, which on most
+// drivers is still able to create surfaceless contexts.
+static EGLDisplay get_display(void) {
+    const char *client = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if(has_extension(client, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if(get_platform_display) {
+            EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            if(display != EGL_NO_DISPLAY) return display;
+        }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+headless_t *headless_new(void) {
+    EGLDisplay display = get_display();
+    if(display == EGL_NO_DISPLAY) {
+        fprintf(stderr, "headless: no EGL display available\n");
+        return NULL;
+    }
+    
+    EGLint major = 0, minor = 0;
+    if(!eglInitialize(display, &major, &minor)) {
+        fprintf(stderr, "headless: could not initialise EGL\n");
+        return NULL;
+    }
+    
+    if(!has_extension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+        fprintf(stderr, "headless: EGL driver does not support surfaceless contexts\n");
+        eglTerminate(display);
+        return NULL;
+    }
+    
+    if(!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "headless: EGL driver does not support desktop OpenGL\n");
+        eglTerminate(display);
+        return NULL;
+    }
+    
+    static const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, 0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config = NULL;
+    EGLint num_configs = 0;
+    if(!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || num_configs < 1) {
+        config = EGL_NO_CONFIG_KHR;
+    }
+    
+    static const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 1,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    if(context == EGL_NO_CONTEXT) {
+        fprintf(stderr, "headless: could not create an OpenGL 4.1 core context\n");
+        eglTerminate(display);
+        return NULL;
+    }
+    
+    if(!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        fprintf(stderr, "headless: could not make context current\n");
+        eglDestroyContext(display, context);
+        eglTerminate(display);
+        return NULL;
+    }
+    
+    headless_t *ctx = calloc(1, sizeof(*ctx));
+    ctx->display = display;
+    ctx->context = context;
+    fprintf(stderr, "headless: EGL %d.%d context created\n", major, minor);
+    return ctx;
+}
+
+void headless_delete(headless_t *ctx) {
+    if(!ctx) return;
+    eglMakeCurrent(ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(ctx->display, ctx->context);
+    eglTerminate(ctx->display);
+    free(ctx);
+}
+
+void *headless_get_proc(const char *name) {
+    return (void *)eglGetProcAddress(name);
+}
+
+#else
+
+headless_t *headless_new(void) {
+    return NULL;
+}
+
+void headless_delete(headless_t *ctx) {
+    (void)ctx;
+}
+
+void *headless_get_proc(const char *name) {
+    (void)name;
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,30 @@
+//===--------------------------------------------------------------------------------------------===
+// headless.h - Window-less OpenGL contexts for offscreen rendering
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct headless_t headless_t;
+
+// Creates an OpenGL 4.1 core context that isn't attached to any window or display server, and
+// makes it current on the calling thread. Returns NULL when the platform can't do that (no EGL,
+// or no surfaceless support in the driver), in which case the caller should fall back on a hidden
+// GLFW window.
+headless_t *headless_new(void);
+void headless_delete(headless_t *ctx);
+
+// Proc address loader to hand to gladLoadGLLoader().
+void *headless_get_proc(const char *name);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,216 @@
+//===--------------------------------------------------------------------------------------------===
+// pngenc.c - PNG encoding of rendered frames
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "pngenc.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+enum {
+    FILTER_NONE,
+    FILTER_SUB,
+    FILTER_UP,
+    FILTER_AVERAGE,
+    FILTER_PAETH,
+    FILTER_COUNT,
+};
+
+static uint8_t paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if(pa <= pb && pa <= pc) return (uint8_t)a;
+    return (uint8_t)(pb <= pc ? b : c);
+}
+
+// Filters `row` against the row above it (`prev`, all zeros for the first row) into `out`.
+static void filter_row(int filter, const uint8_t *row, const uint8_t *prev, size_t length, uint8_t *out) {
+    for(size_t i = 0; i < length; ++i) {
+        int a = i >= 3 ? row[i - 3] : 0;
+        int b = prev[i];
+        int c = i >= 3 ? prev[i - 3] : 0;
+        switch(filter) {
+        case FILTER_NONE:       out[i] = row[i]; break;
+        case FILTER_SUB:        out[i] = (uint8_t)(row[i] - a); break;
+        case FILTER_UP:         out[i] = (uint8_t)(row[i] - b); break;
+        case FILTER_AVERAGE:    out[i] = (uint8_t)(row[i] - ((a + b) >> 1)); break;
+        default:                out[i] = (uint8_t)(row[i] - paeth(a, b, c)); break;
+        }
+    }
+}
+
+// The usual heuristic: the filter whose output, read as signed bytes, is smallest in magnitude
+// tends to compress best.
+static int choose_filter(const uint8_t *row, const uint8_t *prev, size_t length, uint8_t *scratch) {
+    int best = FILTER_NONE;
+    uint64_t best_cost = UINT64_MAX;
+    for(int filter = 0; filter < FILTER_COUNT; ++filter) {
+        filter_row(filter, row, prev, length, scratch);
+        uint64_t cost = 0;
+        for(size_t i = 0; i < length; ++i) cost += (uint64_t)abs((int8_t)scratch[i]);
+        if(cost < best_cost) {
+            best_cost = cost;
+            best = filter;
+        }
+    }
+    return best;
+}
+
+static void put_u32(uint8_t *out, uint32_t value) {
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+static bool write_chunk(FILE *f, const char *type, const uint8_t *data, size_t length) {
+    uint8_t header[8], footer[4];
+    put_u32(header, (uint32_t)length);
+    memcpy(header + 4, type, 4);
+    uLong crc = crc32(0, header + 4, 4);
+    if(length) crc = crc32(crc, data, (uInt)length);
+    put_u32(footer, (uint32_t)crc);
+    
+    return fwrite(header, 1, 8, f) == 8
+        && (!length || fwrite(data, 1, length, f) == length)
+        && fwrite(footer, 1, 4, f) == 4;
+}
+
+// Compressed data is written out in IDAT chunks of this many bytes.
+#define CHUNK_SIZE (256u << 10)
+
+struct png_stream_t {
+    FILE        *file;
+    char        *path;
+    int         width;
+    int         height;
+    int         row;
+    bool        failed;
+    
+    z_stream    zlib;
+    size_t      length;     // bytes in a row, without the filter byte
+    uint8_t     *rows;      // holds the three below
+    uint8_t     *prev;      // last row, unfiltered
+    uint8_t     *cur;
+    uint8_t     *scratch;
+    uint8_t     *filtered;  // filter byte, then the filtered row
+    uint8_t     *chunk;
+};
+
+// Sets `failed` the first time something goes wrong, and reports it.
+static bool fail(png_stream_t *png, const char *what) {
+    if(!png->failed) fprintf(stderr, "could not %s `%s`\n", what, png->path);
+    png->failed = true;
+    return false;
+}
+
+// Runs the deflater on its pending input, writing an IDAT chunk whenever one fills up.
+static bool pump(png_stream_t *png, int flush) {
+    for(;;) {
+        int status = deflate(&png->zlib, flush);
+        if(status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) return fail(png, "compress");
+        
+        size_t used = CHUNK_SIZE - png->zlib.avail_out;
+        bool full = png->zlib.avail_out == 0;
+        if(full || (flush == Z_FINISH && used)) {
+            if(!write_chunk(png->file, "IDAT", png->chunk, used)) return fail(png, "write");
+            png->zlib.next_out = png->chunk;
+            png->zlib.avail_out = CHUNK_SIZE;
+        }
+        if(flush == Z_FINISH ? status == Z_STREAM_END : !full && png->zlib.avail_in == 0) return true;
+    }
+}
+
+png_stream_t *png_stream_new(const char *path, int width, int height) {
+    assert(path);
+    assert(width > 0 && height > 0);
+    
+    FILE *file = fopen(path, "wb");
+    if(!file) {
+        fprintf(stderr, "could not open `%s` for writing\n", path);
+        return NULL;
+    }
+    
+    png_stream_t *png = calloc(1, sizeof(png_stream_t));
+    png->file = file;
+    png->path = strdup(path);
+    png->width = width;
+    png->height = height;
+    png->length = (size_t)width * 3;
+    png->rows = png->prev = calloc(3, png->length);
+    png->cur = png->prev + png->length;
+    png->scratch = png->cur + png->length;
+    png->filtered = malloc(png->length + 1);
+    png->chunk = malloc(CHUNK_SIZE);
+    if(deflateInit(&png->zlib, 6) != Z_OK) fail(png, "compress");
+    png->zlib.next_out = png->chunk;
+    png->zlib.avail_out = CHUNK_SIZE;
+    
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    uint8_t header[13];
+    put_u32(header, (uint32_t)width);
+    put_u32(header + 4, (uint32_t)height);
+    header[8] = 8;      // bits per channel
+    header[9] = 2;      // RGB
+    header[10] = 0;     // deflate
+    header[11] = 0;     // adaptive filtering
+    header[12] = 0;     // not interlaced
+    if(fwrite(signature, 1, sizeof(signature), file) != sizeof(signature)
+       || !write_chunk(file, "IHDR", header, sizeof(header))) {
+        fail(png, "write");
+    }
+    return png;
+}
+
+bool png_stream_rows(png_stream_t *png, const uint8_t *rgba, size_t pitch, int rows) {
+    assert(png);
+    assert(rgba);
+    assert(png->row + rows <= png->height);
+    
+    for(int y = 0; y < rows && !png->failed; ++y) {
+        const uint8_t *src = rgba + y * pitch;
+        for(int x = 0; x < png->width; ++x) memcpy(png->cur + x * 3, src + x * 4, 3);
+        
+        png->filtered[0] = (uint8_t)choose_filter(png->cur, png->prev, png->length, png->scratch);
+        filter_row(png->filtered[0], png->cur, png->prev, png->length, png->filtered + 1);
+        uint8_t *swap = png->prev;
+        png->prev = png->cur;
+        png->cur = swap;
+        
+        png->zlib.next_in = png->filtered;
+        png->zlib.avail_in = (uInt)(png->length + 1);
+        pump(png, Z_NO_FLUSH);
+    }
+    png->row += rows;
+    return !png->failed;
+}
+
+bool png_stream_end(png_stream_t *png) {
+    assert(png);
+    
+    if(png->row != png->height) fail(png, "finish");
+    if(!png->failed && pump(png, Z_FINISH) && !write_chunk(png->file, "IEND", NULL, 0)) fail(png, "write");
+    if(fclose(png->file)) fail(png, "write");
+    
+    bool ok = !png->failed;
+    deflateEnd(&png->zlib);
+    free(png->rows);
+    free(png->filtered);
+    free(png->chunk);
+    free(png->path);
+    free(png);
+    return ok;
+}
+
+bool png_write(const char *path, const uint8_t *rgba, int width, int height) {
+    png_stream_t *png = png_stream_new(path, width, height);
+    if(!png) return false;
+    png_stream_rows(png, rgba, (size_t)width * 4, height);
+    return png_stream_end(png);
+}
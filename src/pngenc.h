@@ -0,0 +1,38 @@
+//===--------------------------------------------------------------------------------------------===
+// pngenc.h - PNG encoding of rendered frames
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct png_stream_t png_stream_t;
+
+// Writes `rgba` (8 bits per channel, top row first) to `path` as an 8-bit RGB PNG; alpha is dropped,
+// like in every other output. The output only depends on the pixels, so frames can be encoded on
+// any thread in any order. Returns false, with a message on stderr, on failure.
+bool png_write(const char *path, const uint8_t *rgba, int width, int height);
+
+// Starts writing a `width`x`height` PNG to `path` a few rows at a time, so that the whole image never
+// has to be in memory. Returns NULL, with a message on stderr, if the file can't be opened.
+png_stream_t *png_stream_new(const char *path, int width, int height);
+
+// Filters and compresses the next `rows` rows of RGBA pixels, `pitch` bytes apart.
+bool png_stream_rows(png_stream_t *png, const uint8_t *rgba, size_t pitch, int rows);
+
+// Finishes the file once every row was written, and frees the stream. Returns false if anything
+// failed along the way.
+bool png_stream_end(png_stream_t *png);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,133 @@
+//===--------------------------------------------------------------------------------------------===
+// pool.c - Worker thread pool
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "pool.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define POOL_MAX_THREADS 32
+
+typedef struct job_t {
+    struct job_t        *next;
+    pool_fn             fn;
+    void                *arg;
+} job_t;
+
+struct pool_t {
+    pthread_t           threads[POOL_MAX_THREADS];
+    int                 count;
+    
+    pthread_mutex_t     lock;
+    pthread_cond_t      work;   // signalled when a job is queued, or when stopping
+    pthread_cond_t      idle;   // signalled when the last outstanding job finishes
+    job_t               *head;
+    job_t               *tail;
+    int                 outstanding;
+    bool                stop;
+};
+
+static void *worker_main(void *arg) {
+    pool_t *pool = arg;
+    
+    pthread_mutex_lock(&pool->lock);
+    for(;;) {
+        while(!pool->head && !pool->stop) pthread_cond_wait(&pool->work, &pool->lock);
+        if(!pool->head) break;
+        
+        job_t *job = pool->head;
+        pool->head = job->next;
+        if(!pool->head) pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+        
+        job->fn(job->arg);
+        free(job);
+        
+        pthread_mutex_lock(&pool->lock);
+        pool->outstanding -= 1;
+        if(!pool->outstanding) pthread_cond_broadcast(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+pool_t *pool_new(int threads) {
+    if(threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if(threads > POOL_MAX_THREADS) threads = POOL_MAX_THREADS;
+    
+    pool_t *pool = calloc(1, sizeof(pool_t));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    
+    for(int i = 0; i < threads; ++i) {
+        if(pthread_create(&pool->threads[pool->count], NULL, worker_main, pool)) break;
+        pool->count += 1;
+    }
+    if(!pool->count) {
+        fprintf(stderr, "could not start worker threads\n");
+        pthread_cond_destroy(&pool->idle);
+        pthread_cond_destroy(&pool->work);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void pool_delete(pool_t *pool) {
+    if(!pool) return;
+    
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    
+    for(int i = 0; i < pool->count; ++i) pthread_join(pool->threads[i], NULL);
+    assert(!pool->head);
+    
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int pool_size(const pool_t *pool) {
+    assert(pool);
+    return pool->count;
+}
+
+void pool_submit(pool_t *pool, pool_fn fn, void *arg) {
+    assert(pool);
+    assert(fn);
+    
+    job_t *job = malloc(sizeof(job_t));
+    job->next = NULL;
+    job->fn = fn;
+    job->arg = arg;
+    
+    pthread_mutex_lock(&pool->lock);
+    if(pool->tail) pool->tail->next = job;
+    else pool->head = job;
+    pool->tail = job;
+    pool->outstanding += 1;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(pool_t *pool) {
+    assert(pool);
+    pthread_mutex_lock(&pool->lock);
+    while(pool->outstanding) pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,37 @@
+//===--------------------------------------------------------------------------------------------===
+// pool.h - Worker thread pool
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*pool_fn)(void *arg);
+typedef struct pool_t pool_t;
+
+// Starts `threads` workers, or one per CPU when `threads` is 0. Returns NULL if no thread could be
+// started at all.
+pool_t *pool_new(int threads);
+
+// Waits for every job submitted so far to finish, then stops the workers.
+void pool_delete(pool_t *pool);
+
+int pool_size(const pool_t *pool);
+
+// Queues `fn(arg)` to run on one of the workers. Jobs start in submission order, but may finish
+// in any order. Jobs don't touch GL: workers have no context.
+void pool_submit(pool_t *pool, pool_fn fn, void *arg);
+
+// Blocks until every job submitted so far has finished.
+void pool_wait(pool_t *pool);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
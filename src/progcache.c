@@ -0,0 +1,175 @@
+//===--------------------------------------------------------------------------------------------===
+// progcache.c - On-disk cache of linked program binaries
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "progcache.h"
+#include "hash.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC     0x42505348u // 'SHPB'
+#define CACHE_VERSION   1
+
+typedef struct {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    format;
+    uint32_t    length;
+    uint64_t    key;
+    double      compile_ms;
+} cache_header_t;
+
+char *progcache_default_dir(void) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    const char *fmt = NULL;
+    const char *base = NULL;
+    
+    if(xdg && *xdg) {
+        fmt = "%s/shades";
+        base = xdg;
+    } else if(home && *home) {
+        fmt = "%s/.cache/shades";
+        base = home;
+    } else {
+        return NULL;
+    }
+    
+    size_t len = snprintf(NULL, 0, fmt, base);
+    char *dir = calloc(len + 1, sizeof(char));
+    snprintf(dir, len + 1, fmt, base);
+    return dir;
+}
+
+bool progcache_init(const char *dir) {
+    assert(dir);
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if(formats < 1) {
+        fprintf(stderr, "program cache disabled: driver does not support program binaries\n");
+        return false;
+    }
+    if(!make_dirs(dir)) {
+        fprintf(stderr, "program cache disabled: could not create `%s`\n", dir);
+        return false;
+    }
+    return true;
+}
+
+uint64_t progcache_key(const char **sources, int count) {
+    uint64_t key = HASH_INIT;
+    key = hash_str(key, (const char *)glGetString(GL_VENDOR));
+    key = hash_str(key, (const char *)glGetString(GL_RENDERER));
+    key = hash_str(key, (const char *)glGetString(GL_VERSION));
+    for(int i = 0; i < count; ++i) {
+        key = hash_str(key, sources[i]);
+    }
+    return key;
+}
+
+// The binary is whatever follows the header, so an entry is only as long as its header says.
+static bool valid_header(const cache_header_t *header, uint64_t key, off_t file_size) {
+    if(header->magic != CACHE_MAGIC || header->version != CACHE_VERSION || header->key != key) return false;
+    return header->length > 0 && file_size == (off_t)(sizeof(cache_header_t) + header->length);
+}
+
+static void cache_path(char *out, size_t size, const char *dir, uint64_t key) {
+    snprintf(out, size, "%s/%016" PRIx64 ".bin", dir, key);
+}
+
+GLuint progcache_load(const char *dir, uint64_t key, double *compile_ms) {
+    assert(dir);
+    char path[strlen(dir) + 32];
+    cache_path(path, sizeof(path), dir, key);
+    
+    FILE *f = fopen(path, "rb");
+    if(!f) return 0;
+    
+    cache_header_t header;
+    void *binary = NULL;
+    GLuint prog = 0;
+    
+    struct stat st;
+    if(fstat(fileno(f), &st) || fread(&header, sizeof(header), 1, f) != 1) goto done;
+    if(!valid_header(&header, key, st.st_size)) {
+        fprintf(stderr, "program cache: discarding invalid entry `%s`\n", path);
+        remove(path);
+        goto done;
+    }
+    
+    binary = malloc(header.length);
+    if(!binary || fread(binary, 1, header.length, f) != header.length) goto done;
+    
+    prog = glCreateProgram();
+    glProgramBinary(prog, header.format, binary, header.length);
+    
+    GLint status = 0;
+    glGetProgramiv(prog, GL_LINK_STATUS, &status);
+    if(status != GL_TRUE) {
+        fprintf(stderr, "program cache: driver rejected cached binary `%s`\n", path);
+        glDeleteProgram(prog);
+        prog = 0;
+        remove(path);
+        goto done;
+    }
+    if(compile_ms) *compile_ms = header.compile_ms;
+    
+done:
+    free(binary);
+    fclose(f);
+    return prog;
+}
+
+void progcache_store(const char *dir, uint64_t key, GLuint prog, double compile_ms) {
+    assert(dir);
+    assert(prog);
+    
+    GLint length = 0;
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0) return;
+    
+    void *binary = malloc(length);
+    GLenum format = 0;
+    glGetProgramBinary(prog, length, &length, &format, binary);
+    
+    char path[strlen(dir) + 32];
+    cache_path(path, sizeof(path), dir, key);
+    
+    // Write to a temporary file and rename it in place, so that a second instance never sees a
+    // half-written binary.
+    char tmp[sizeof(path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    
+    FILE *f = fopen(tmp, "wb");
+    if(!f) {
+        fprintf(stderr, "program cache: could not write `%s`\n", tmp);
+        free(binary);
+        return;
+    }
+    
+    cache_header_t header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .format = format,
+        .length = length,
+        .key = key,
+        .compile_ms = compile_ms,
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+           && fwrite(binary, 1, length, f) == (size_t)length;
+    ok = !fclose(f) && ok;
+    free(binary);
+    
+    if(!ok || rename(tmp, path)) {
+        fprintf(stderr, "program cache: could not write `%s`\n", path);
+        remove(tmp);
+    }
+}
@@ -0,0 +1,39 @@
+//===--------------------------------------------------------------------------------------------===
+// progcache.h - On-disk cache of linked program binaries
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include "gl.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns the default cache directory ($XDG_CACHE_HOME/shades, or ~/.cache/shades). The string is
+// heap-allocated, and NULL if neither variable is set.
+char *progcache_default_dir(void);
+
+// Checks that the driver can save program binaries at all and creates `dir` if needed. Must be
+// called with a current context.
+bool progcache_init(const char *dir);
+
+// Key for a program built from `count` shader sources. The driver vendor, renderer and version are
+// part of the key, since binaries are only valid for the exact driver that produced them.
+uint64_t progcache_key(const char **sources, int count);
+
+// Tries to create a program from a cached binary. Returns 0 on a miss, or if the driver rejected the
+// binary (e.g. after a driver update). `compile_ms` receives how long the original build took.
+GLuint progcache_load(const char *dir, uint64_t key, double *compile_ms);
+
+// Saves the binary of a linked program. It must have been linked with
+// GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+void progcache_store(const char *dir, uint64_t key, GLuint prog, double compile_ms);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -13,52 +13,236 @@
 #include <getopt.h>
 #include <string.h>
 #include "gl.h"
+#include "headless.h"
+#include "timer.h"
+#include "stats.h"
+#include "progcache.h"
+#include "compiler.h"
+#include "watch.h"
+#include "graph.h"
+#include "dynres.h"
+#include "pool.h"
+#include "texload.h"
+#include "upload.h"
+#include "texcache.h"
+#include "bcenc.h"
+#include "source.h"
+#include "hash.h"
+#include "capture.h"
+#include "pngenc.h"
+#include "tiler.h"
 
 #define WIDTH   1024
 #define HEIGHT  800
 #define SCALE   2
+#define FPS     60
 #define NAME    "Shades"
 
-#define MAX_TEXTURES 4
+#define MAX_TEXTURES GRAPH_MAX_INPUTS
+#define MAX_IMAGES   16
+#define STATS_WINDOW 1000
+#define BENCH_WARMUP 60
+#define DYNRES_MIN   0.5f
+
+// Texture uploads are streamed through a few staging buffers, and spread over as many frames as it
+// takes to stay under a per-frame transfer budget.
+#define UPLOAD_SLOTS        3
+#define UPLOAD_SLOT_SIZE    (4u << 20)
+#define UPLOAD_BUDGET       (8u << 20)
+
+// With nothing to draw, the window sleeps until an event comes in. It still wakes up this often (in
+// seconds) to check on changed files, and more often while builds or images are in flight.
+#define IDLE_WATCH_POLL     0.1
+#define IDLE_WORK_POLL      (1.0 / 120.0)
+
+// Built-in uniforms live in std140 blocks, all backed by a single buffer written once per frame.
+// Frame-wide blocks are bound once; each pass has its own range for the per-pass ones.
+enum {
+    BLOCK_FRAME,    // u_res, u_scale
+    BLOCK_TIME,     // u_time, on its own so that programs that don't animate can be detected
+    BLOCK_PASS,     // u_frag_map
+    BLOCK_INPUTS,   // u_tex_res
+    BLOCK_COUNT,
+};
+
+static const char *block_names[BLOCK_COUNT] = {
+    "shades_frame", "shades_time", "shades_pass", "shades_inputs",
+};
+
+// std140 layouts of the blocks above. Array elements are padded to a vec4.
+typedef struct {
+    float           res[2];
+    float           scale;
+    float           pad;
+} frame_block_t;
+
+typedef struct {
+    float           time;
+    float           pad[3];
+} time_block_t;
+
+typedef struct {
+    float           frag_map[4];
+} pass_block_t;
+
+typedef struct {
+    float           tex_res[MAX_TEXTURES][4];
+} inputs_block_t;
+
+// Counts the GL calls issued by run_loop(), so --stats can show what a frame costs the driver.
+#define COUNT_GL(data, call) do { (data)->perf.gl_calls += 1; call; } while(0)
+#define HAS_UNIFORM(loc) ((GLint)(loc) != -1)
+#define UNBOUND ((GLuint)-1)
+
+#ifndef GL_TEXTURE_MAX_ANISOTROPY_EXT
+#define GL_TEXTURE_MAX_ANISOTROPY_EXT       0x84FE
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT   0x84FF
+#endif
 
 typedef struct {
     GLuint          prog;
+    uint64_t        key;        // of everything the program was built from
     const char      *path;
+    int             watch;
+    int             *includes;  // indices into the included files, see shades_data_t
+    int             num_includes;
     
-    struct {
-        GLuint      vtx_pos;
-    } attr;
-    
-    struct {
-        GLuint      pvm;
-        GLuint      tex0;
-        GLuint      tex1;
-        GLuint      tex2;
-        GLuint      tex3;
-        GLuint      tex_res;
-        GLuint      res;
-        GLuint      time;
-        GLuint      scale;
-    } uniform;
+    GLint           samplers[MAX_TEXTURES];
+    bool            reads_sizes; // the program reads u_tex_res
 } shader_info_t;
 
 typedef struct {
-    GLuint          tex;
+    shader_info_t   shader;
+    
+    bool            needs_build;
+    bool            is_static;  // the program doesn't read u_time
+    bool            valid;      // the pass's output is up to date
+    bool            rendered;   // the pass rendered during this frame
+} pass_info_t;
+
+typedef struct {
+    GLuint          tex;        // 0 until the first decode has been uploaded
     vect2_t         size;
     const char      *path;
+    int             watch;
+    unsigned        generation; // bumped by every load, so stale decodes can be told apart
+    double          decode_ms;
+    bool            cached;
+    GLenum          compress;   // block-compressed format, or 0
+    GLenum          internal;   // storage format of `tex`
+    uint64_t        hash;       // texels of the last image handed to the uploader, 0 before
+    bool            requested;  // a program reads it, so it's been loaded
 } texture_info_t;
 
+typedef struct {
+    char            *path;
+    int             watch;
+    bool            changed;    // during poll_watch()
+} include_info_t;
+
 typedef struct {
     vect2_t         pos;
     vect2_t         tex0;
 } vertex_t;
 
+// Sampling parameters for one texture channel, from --sampler.
 typedef struct {
-    shader_info_t   shader;
-    texture_info_t  textures[MAX_TEXTURES];
+    bool            set;
+    GLenum          min_filter;
+    GLenum          mag_filter;
+    GLenum          wrap;
+    float           anisotropy;
+} sampler_spec_t;
+
+typedef struct {
+    bool            enabled;
+    bool            report;
+    gpu_timer_t     timer;
+    stats_t         cpu_ms;
+    stats_t         frame_ms;
+    stats_t         draw_ms;
+    FILE            *csv;
+    double          last_report;
+    long            measure_from;
+    unsigned        gl_calls;
+    int             width;      // resolution the screen pass renders at
+    int             height;
+} perf_t;
+
+typedef struct {
+    pass_info_t     passes[GRAPH_MAX_PASSES];
+    graph_t         graph;
+    texture_info_t  textures[MAX_IMAGES];
+    int             num_textures;
+    GLuint          placeholder;
+    GLuint          samplers[MAX_TEXTURES];
+    pool_t          *pool;
+    texload_t       *loader;
+    uploader_t      *uploader;
+    perf_t          perf;
     
     float           scale;
     vect2_t         size;
+    double          time;
+    long            frame;
+    bool            redraw;     // the screen needs presenting again, even if no pass changed
+    GLuint          screen;
+    
+    // Images too large for one render target are rendered a tile at a time. The screen target is
+    // then only as large as the tile, and the screen pass is offset so that it still sees the
+    // whole image's coordinates.
+    bool            tiled;
+    tile_t          tile;
+    
+    // With an integer u_scale, the screen pass can be rendered once per logical pixel and blown up
+    // to the screen. With dynamic resolution, it is rendered at whatever fraction of the screen's
+    // size keeps the GPU under budget. Either way, it renders into this target.
+    struct {
+        GLuint      tex;
+        GLuint      fbo;
+        int         width;
+        int         height;
+        float       scale_x;
+        float       scale_y;
+        GLenum      filter;
+    } internal;
+    bool            logical;
+    bool            use_dynres;
+    dynres_t        dynres;
+    
+    // What's currently bound, so passes only change what differs from the previous draw. Anything
+    // that binds things behind our back must call invalidate_bindings().
+    struct {
+        GLuint      prog;
+        GLuint      fbo;
+        int         width;
+        int         height;
+        GLuint      unit;
+        GLuint      tex[MAX_TEXTURES];
+        int         blocks;     // pass whose uniform ranges are bound
+    } bound;
+    
+    // The buffer behind every built-in uniform block, and its contents as of the last upload.
+    struct {
+        GLuint      ubo;
+        size_t      align;      // bound ranges must start at a multiple of this
+        size_t      offsets[BLOCK_COUNT];
+        size_t      stride;     // between consecutive passes' ranges
+        size_t      size;
+        uint8_t     *uploaded;
+        uint8_t     *next;
+        bool        valid;      // `uploaded` matches the buffer
+    } uniforms;
+    
+    const char      *cache_dir;     // program binaries
+    const char      *texcache_dir;  // decoded images
+    compiler_t      *compiler;
+    int             building;
+    uint64_t        build_key;
+    source_cache_t  *sources;
+    include_info_t  *includes;      // every file the shaders included so far
+    int             num_includes;
+    watch_t         *watch;
     
     GLuint          vao;
     GLuint          vbo;
@@ -67,14 +251,11 @@ typedef struct {
     vect2_t         vert[4];
     GLuint          indices[6];
     
-    
-    float           proj[16];
 } shades_data_t;
 
 static const char *vert_shader =
     "#version 400\n"
-    "uniform mat4   u_pvm;\n"
-    "in vec2        in_vtx_pos;\n"
+    "layout(location = 0) in vec2 in_vtx_pos;\n"
     "void main() {\n"
     "    gl_Position = vec4(in_vtx_pos, 0.0, 1.0);\n"
     "}\n";
@@ -85,17 +266,28 @@ static const char *frag_defines =
     "uniform sampler2D  u_tex1;\n"
     "uniform sampler2D  u_tex2;\n"
     "uniform sampler2D  u_tex3;\n"
-    "uniform vec2       u_tex_res[4];\n"
-    "uniform vec2       u_res;\n"
-    "uniform float      u_time;\n"
-    "uniform float      u_scale;\n"
+    "layout(std140) uniform shades_frame {\n"
+    "    vec2           u_res;\n"
+    "    float          u_scale;\n"
+    "};\n"
+    "layout(std140) uniform shades_time {\n"
+    "    float          u_time;\n"
+    "};\n"
+    "layout(std140) uniform shades_inputs {\n"
+    "    vec2           u_tex_res[4];\n"
+    "};\n"
     "\n"
     "out vec4           out_color;\n"  
     "\n";
 
+// u_frag_map maps gl_FragCoord to top-down pixel coordinates: the screen is y-flipped, buffer
+// passes aren't, so that they sample the same way image textures do.
 static const char *frag_shader =
+    "layout(std140) uniform shades_pass {\n"
+    "    vec4           u_frag_map;\n"
+    "};\n"
     "void main() {\n"
-    "    vec2 coord = vec2(gl_FragCoord.x, u_res.y-gl_FragCoord.y);\n"
+    "    vec2 coord = gl_FragCoord.xy * u_frag_map.xy + u_frag_map.zw;\n"
     "    out_color = main_image(coord / u_scale);\n"
     "}\n";
 
@@ -105,48 +297,239 @@ static void glfw_error(int code, const char *message) {
     fprintf(stderr, "glfw error [%d]: %s\n", code, message);
 }
 
-static GLuint reload_shader(GLuint prog, const char *path) {
-    if(prog) {
-        glDeleteProgram(prog);
-        prog = 0;
+static void invalidate_bindings(shades_data_t *data) {
+    data->bound.prog = UNBOUND;
+    data->bound.fbo = UNBOUND;
+    data->bound.width = -1;
+    data->bound.height = -1;
+    data->bound.unit = UNBOUND;
+    data->bound.blocks = -1;
+    for(int i = 0; i < MAX_TEXTURES; ++i) data->bound.tex[i] = UNBOUND;
+}
+
+// Static passes need to render again after a change to the uniforms they all read.
+static void mark_passes(shades_data_t *data) {
+    for(int i = 0; i < data->graph.count; ++i) data->passes[i].valid = false;
+}
+
+// Passes reading an image need to re-render when it is reloaded, even if they could otherwise
+// be skipped.
+static void invalidate_image(shades_data_t *data, int image) {
+    for(int i = 0; i < data->graph.count; ++i) {
+        for(int j = 0; j < MAX_TEXTURES; ++j) {
+            const graph_input_t *in = &data->graph.passes[i].inputs[j];
+            if(in->kind == INPUT_IMAGE && in->index == image) data->passes[i].valid = false;
+        }
     }
+}
+
+// Images are decoded on the worker pool, then streamed to the GPU. Until a texture's first upload
+// is complete, passes sample a 1x1 placeholder instead. Reloads keep the previous image bound
+// until the new one is ready, unless they have the same size and format and fit in one frame's
+// upload budget: then they're written over the existing texture in a single step. Reloads whose
+// texels didn't change are skipped altogether.
+static void start_texture_load(shades_data_t *data, int index) {
+    texture_info_t *texture = &data->textures[index];
+    texture->generation += 1;
+    texload_start(data->loader, index, texture->generation, texture->path, texture->compress);
+}
+
+static void finish_texture(shades_data_t *data, const upload_done_t *done) {
+    texture_info_t *texture = &data->textures[done->id];
+    bool in_place = texture->tex == done->tex;
+    if(texture->tex && !in_place) glDeleteTextures(1, &texture->tex);
+    texture->tex = done->tex;
+    texture->size = VECT2(done->width, done->height);
+    texture->internal = done->internal;
+    
+    const char *format = bcenc_name(done->internal);
+    fprintf(stderr, "%s texture `%s` (%dx%d%s%s): %s in %.1f ms, uploaded in %.1f ms over %d frame%s\n",
+            in_place ? "refreshed" : "loaded", texture->path, done->width, done->height, format ? ", " : "", format ? format : "",
+            texture->cached ? "mapped from cache" : "decoded", texture->decode_ms, done->upload_ms,
+            done->steps, done->steps == 1 ? "" : "s");
+    invalidate_image(data, done->id);
+}
+
+// Hands finished decodes to the uploader, and streams at most UPLOAD_BUDGET bytes to the GPU.
+// Textures are swapped in once they are complete. With `wait`, blocks until everything that was
+// being loaded has been uploaded.
+static void poll_textures(shades_data_t *data, bool wait) {
+    if(!data->loader) return;
+    
+    texload_result_t result;
+    while(texload_poll(data->loader, &result, wait)) {
+        texture_info_t *texture = &data->textures[result.id];
+        if(result.generation != texture->generation) {
+            // Another load of the same file was started since, and it'll be here soon enough.
+            if(result.ok) gl_free_image(&result.image);
+            continue;
+        }
+        if(!result.ok) continue;
+        if(result.hash == texture->hash) {
+            fprintf(stderr, "texture `%s` is unchanged, skipping upload\n", texture->path);
+            gl_free_image(&result.image);
+            continue;
+        }
         
-    char *source = load_source(path);
-    if(!source) {
-        fprintf(stderr, "could not open shader source `%s`\n", path);
-        return 0;
+        const gl_image_t *image = &result.image;
+        bool same_shape = texture->tex && texture->internal == image->internal
+                       && texture->size.x == image->width && texture->size.y == image->height;
+        // A bound texture can't be refreshed over several frames without tearing, so only small
+        // images reuse its storage.
+        bool in_place = same_shape && gl_image_size(image, image->levels) <= UPLOAD_BUDGET;
+        texture->decode_ms = result.decode_ms;
+        texture->cached = result.cached;
+        texture->hash = result.hash;
+        uploader_start(data->uploader, result.id, result.generation, &result.image, in_place ? texture->tex : 0);
     }
-    fprintf(stderr, "loaded fragment shader source `%s`\n", path);
-    GLuint vert = gl_load_shader(GL_VERTEX_SHADER, vert_shader, NULL);
-    if(!vert) return 0;
-    GLuint frag = gl_load_shader(GL_FRAGMENT_SHADER, frag_defines, source, frag_shader, NULL);
-    if(!frag) return 0;
     
-    prog = glCreateProgram();
-    glAttachShader(prog, vert);
-    glAttachShader(prog, frag);
-    glLinkProgram(prog);
+    if(!uploader_busy(data->uploader)) return;
+    size_t budget = UPLOAD_BUDGET;
+    upload_done_t done;
+    while(uploader_step(data->uploader, &budget, wait, &done)) {
+        finish_texture(data, &done);
+    }
+    invalidate_bindings(data);
+}
 
-    glDeleteShader(vert);
-    glDeleteShader(frag);
+// Images read on a channel set up with --compress are block-compressed when they're loaded. An image
+// read on several channels uses the first one's format.
+static void load_textures(shades_data_t *data, const GLenum *compress) {
+    static const uint8_t black[4] = {0, 0, 0, 255};
+    for(int i = 0; i < MAX_TEXTURES; ++i) {
+        if(compress[i] && !bcenc_supported(compress[i])) {
+            fprintf(stderr, "%s compression is not supported by this driver, u_tex%d stays uncompressed\n",
+                    bcenc_name(compress[i]), i);
+        }
+    }
+    for(int i = 0; i < data->graph.count; ++i) {
+        for(int j = 0; j < MAX_TEXTURES; ++j) {
+            const graph_input_t *in = &data->graph.passes[i].inputs[j];
+            if(in->kind != INPUT_IMAGE || !compress[j] || !bcenc_supported(compress[j])) continue;
+            texture_info_t *texture = &data->textures[in->index];
+            if(!texture->compress) texture->compress = compress[j];
+        }
+    }
+    
+    data->placeholder = gl_create_tex(1, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, black);
+    
+    data->pool = pool_new(0);
+    if(!data->pool) die("could not start texture decoding");
+    data->loader = texload_new(data->pool, data->texcache_dir);
+    data->uploader = uploader_new(UPLOAD_SLOTS, UPLOAD_SLOT_SIZE);
+}
 
-    if(!gl_check_program(prog)) {
-        glDeleteProgram(prog);
-        return 0;
+// Images are loaded the first time an installed program reads them. Presets often pass the same
+// images to many shaders, and the ones a shader's sampler was optimised out of are never decoded.
+// Channels count as read when their sampler is active. Uniform blocks are active as a whole, so a
+// program that reads u_tex_res reads every channel.
+static void request_textures(shades_data_t *data, int index) {
+    const shader_info_t *shader = &data->passes[index].shader;
+    for(int i = 0; i < MAX_TEXTURES; ++i) {
+        const graph_input_t *in = &data->graph.passes[index].inputs[i];
+        if(in->kind != INPUT_IMAGE || data->textures[in->index].requested) continue;
+        if(!HAS_UNIFORM(shader->samplers[i]) && !shader->reads_sizes) continue;
+        data->textures[in->index].requested = true;
+        start_texture_load(data, in->index);
     }
-    return prog;
 }
 
-static GLuint reload_texture(GLuint tex, const char *path, vect2_t *size) {
-    if(tex) {
-        glDeleteTextures(1, &tex);
-        tex = 0;
+// Reloads the images that were loaded already. The others wait until a program reads them.
+static void reload_textures(shades_data_t *data, bool changed_only) {
+    for(int i = 0; i < data->num_textures; ++i) {
+        texture_info_t *texture = &data->textures[i];
+        if(!texture->requested) continue;
+        if(changed_only && !watch_changed(data->watch, texture->watch)) continue;
+        start_texture_load(data, i);
+    }
+}
+
+// Channels configured with --sampler get a sampler object, bound to their unit once and for all.
+// The others sample with their texture's own parameters: nearest and repeat for images, linear and
+// clamped for buffers.
+static void init_samplers(shades_data_t *data, const sampler_spec_t *specs) {
+    float max_anisotropy = 1.f;
+    if(gl_has_extension("GL_EXT_texture_filter_anisotropic") || gl_has_extension("GL_ARB_texture_filter_anisotropic")) {
+        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_anisotropy);
     }
     
-    int w, h;
-    tex = gl_load_tex(path, &w, &h);
-    if(size) *size = VECT2(w, h);
-    return tex;
+    for(int i = 0; i < MAX_TEXTURES; ++i) {
+        const sampler_spec_t *spec = &specs[i];
+        if(!spec->set) continue;
+        
+        GLuint sampler = 0;
+        glGenSamplers(1, &sampler);
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, spec->min_filter);
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, spec->mag_filter);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, spec->wrap);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, spec->wrap);
+        
+        if(spec->anisotropy > 1.f) {
+            float anisotropy = spec->anisotropy;
+            if(anisotropy > max_anisotropy) {
+                fprintf(stderr, "u_tex%d: anisotropy limited to %g\n", i, max_anisotropy);
+                anisotropy = max_anisotropy;
+            }
+            if(anisotropy > 1.f) glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy);
+        }
+        
+        glBindSampler(i, sampler);
+        data->samplers[i] = sampler;
+    }
+}
+
+static void fini_textures(shades_data_t *data) {
+    for(int i = 0; i < MAX_TEXTURES; ++i) {
+        if(data->samplers[i]) glDeleteSamplers(1, &data->samplers[i]);
+        data->samplers[i] = 0;
+    }
+    texload_delete(data->loader);
+    uploader_delete(data->uploader);
+    pool_delete(data->pool);
+    data->loader = NULL;
+    data->uploader = NULL;
+    data->pool = NULL;
+}
+
+static size_t align_up(size_t size, size_t align) {
+    return (size + align - 1) / align * align;
+}
+
+// Lays out the uniform buffer: the frame-wide blocks first, then one range per pass. The frame-wide
+// blocks never move, so they are bound here once and for all.
+static void init_uniforms(shades_data_t *data) {
+    GLint align = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+    size_t a = data->uniforms.align = align > 0 ? (size_t)align : 256;
+    
+    size_t *offsets = data->uniforms.offsets;
+    offsets[BLOCK_FRAME] = 0;
+    offsets[BLOCK_TIME] = align_up(sizeof(frame_block_t), a);
+    offsets[BLOCK_PASS] = offsets[BLOCK_TIME] + align_up(sizeof(time_block_t), a);
+    offsets[BLOCK_INPUTS] = offsets[BLOCK_PASS] + align_up(sizeof(pass_block_t), a);
+    data->uniforms.stride = align_up(sizeof(pass_block_t), a) + align_up(sizeof(inputs_block_t), a);
+    data->uniforms.size = offsets[BLOCK_PASS] + data->graph.count * data->uniforms.stride;
+    
+    data->uniforms.uploaded = calloc(1, data->uniforms.size);
+    data->uniforms.next = calloc(1, data->uniforms.size);
+    data->uniforms.valid = false;
+    
+    glGenBuffers(1, &data->uniforms.ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, data->uniforms.ubo);
+    glBufferData(GL_UNIFORM_BUFFER, data->uniforms.size, NULL, GL_DYNAMIC_DRAW);
+    glBindBufferRange(GL_UNIFORM_BUFFER, BLOCK_FRAME, data->uniforms.ubo,
+                      offsets[BLOCK_FRAME], sizeof(frame_block_t));
+    glBindBufferRange(GL_UNIFORM_BUFFER, BLOCK_TIME, data->uniforms.ubo,
+                      offsets[BLOCK_TIME], sizeof(time_block_t));
+}
+
+static void fini_uniforms(shades_data_t *data) {
+    if(data->uniforms.ubo) glDeleteBuffers(1, &data->uniforms.ubo);
+    free(data->uniforms.uploaded);
+    free(data->uniforms.next);
+    data->uniforms.ubo = 0;
+    data->uniforms.uploaded = data->uniforms.next = NULL;
 }
 
 static void setup(shades_data_t *data) {
@@ -155,8 +538,6 @@ static void setup(shades_data_t *data) {
     data->vert[2] = VECT2(1, 1);
     data->vert[3] = VECT2(-1, 1);
     
-    gl_ortho(data->proj, 0, 0, data->size.x, data->size.y);
-    
     glGenVertexArrays(1, &data->vao);
     glBindVertexArray(data->vao);
     
@@ -169,65 +550,594 @@ static void setup(shades_data_t *data) {
     
     glBindBuffer(GL_ARRAY_BUFFER, data->vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(data->vert), data->vert, GL_STATIC_DRAW);
+    
+    // Every pass uses the same quad, and the vertex shader pins in_vtx_pos to location 0, so the VAO
+    // is set up once and never rebound.
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vect2_t), (void*)0);
+    
+    init_uniforms(data);
+    graph_resize(&data->graph, data->size.x, data->size.y);
+    invalidate_bindings(data);
 }
 
-static void fetch_shader_info(shades_data_t *data) {
-    glUseProgram(data->shader.prog);
-    glBindVertexArray(data->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, data->vbo);
+// Points the program's built-in blocks at their binding points, and its samplers at their units.
+// Both stick with the program, so this happens once per build rather than once per draw.
+static void fetch_shader_info(pass_info_t *pass) {
+    shader_info_t *shader = &pass->shader;
+    bool active[BLOCK_COUNT];
+    for(int i = 0; i < BLOCK_COUNT; ++i) {
+        GLuint block = glGetUniformBlockIndex(shader->prog, block_names[i]);
+        active[i] = block != GL_INVALID_INDEX;
+        if(active[i]) glUniformBlockBinding(shader->prog, block, i);
+    }
     
-    data->shader.attr.vtx_pos = glGetAttribLocation(data->shader.prog, "in_vtx_pos");
-    data->shader.uniform.pvm = glGetUniformLocation(data->shader.prog, "u_pvm");
-    data->shader.uniform.tex0 = glGetUniformLocation(data->shader.prog, "u_tex0");
-    data->shader.uniform.tex1 = glGetUniformLocation(data->shader.prog, "u_tex1");
-    data->shader.uniform.tex2 = glGetUniformLocation(data->shader.prog, "u_tex2");
-    data->shader.uniform.tex3 = glGetUniformLocation(data->shader.prog, "u_tex3");
-    data->shader.uniform.tex_res = glGetUniformLocation(data->shader.prog, "u_tex_res");
-    data->shader.uniform.res = glGetUniformLocation(data->shader.prog, "u_res");
-    data->shader.uniform.time = glGetUniformLocation(data->shader.prog, "u_time");
-    data->shader.uniform.scale = glGetUniformLocation(data->shader.prog, "u_scale");
+    glUseProgram(shader->prog);
+    for(int i = 0; i < MAX_TEXTURES; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "u_tex%d", i);
+        shader->samplers[i] = glGetUniformLocation(shader->prog, name);
+        if(HAS_UNIFORM(shader->samplers[i])) glUniform1i(shader->samplers[i], i);
+    }
+    shader->reads_sizes = active[BLOCK_INPUTS];
     
-    glEnableVertexAttribArray(data->shader.attr.vtx_pos);
-    glVertexAttribPointer(data->shader.attr.vtx_pos, 2, GL_FLOAT, GL_FALSE, sizeof(vect2_t), (void*)0);
+    pass->is_static = !active[BLOCK_TIME];
+    pass->valid = false;
 }
 
-static void run_loop(const shades_data_t *data) {
-    glBindVertexArray(data->vao);
-    glUseProgram(data->shader.prog);
+static void install_program(shades_data_t *data, int index, GLuint prog, uint64_t key) {
+    pass_info_t *pass = &data->passes[index];
+    if(pass->shader.prog) glDeleteProgram(pass->shader.prog);
+    pass->shader.prog = prog;
+    pass->shader.key = key;
+    fetch_shader_info(pass);
     
-    glUniformMatrix4fv(data->shader.uniform.pvm, 1, GL_TRUE, data->proj);
-    glUniform1i(data->shader.uniform.tex0, 0);
-    glUniform1i(data->shader.uniform.tex1, 1);
-    glUniform1i(data->shader.uniform.tex2, 2);
-    glUniform1i(data->shader.uniform.tex3, 3);
+    // Static buffers keep their output around, so they can be skipped while nothing changes.
+    graph_pass_t *node = &data->graph.passes[index];
+    node->persistent = node->feedback || pass->is_static;
+    data->bound.prog = UNBOUND;
+    request_textures(data, index);
+}
+
+// Remembers which files a shader included, and watches the ones we haven't seen yet, so that editing
+// a library rebuilds every pass that uses it.
+static void track_includes(shades_data_t *data, shader_info_t *shader, const source_t *source) {
+    shader->num_includes = 0;
+    shader->includes = realloc(shader->includes, source->file_count * sizeof(int));
+    for(int i = 1; i < source->file_count; ++i) {
+        int index = 0;
+        while(index < data->num_includes && strcmp(data->includes[index].path, source->files[i])) ++index;
+        if(index == data->num_includes) {
+            data->includes = realloc(data->includes, (index + 1) * sizeof(include_info_t));
+            data->includes[index] = (include_info_t){
+                .path = strdup(source->files[i]),
+                .watch = data->watch ? watch_add(data->watch, source->files[i]) : -1,
+            };
+            data->num_includes += 1;
+        }
+        shader->includes[shader->num_includes++] = index;
+    }
+}
+
+static void fini_sources(shades_data_t *data) {
+    for(int i = 0; i < data->graph.count; ++i) free(data->passes[i].shader.includes);
+    for(int i = 0; i < data->num_includes; ++i) free(data->includes[i].path);
+    free(data->includes);
+    source_cache_delete(data->sources);
+}
+
+// Starts the next queued program build. Cache hits are installed straight away. Anything else is
+// built in the background, and the old program keeps rendering until the new one has linked
+// successfully, so a broken shader never leaves us with a black screen.
+static void start_next_build(shades_data_t *data) {
+    for(int i = 0; i < data->graph.count; ++i) {
+        if(compiler_poll(data->compiler, false) != BUILD_IDLE) return;
+        
+        pass_info_t *pass = &data->passes[i];
+        if(!pass->needs_build) continue;
+        pass->needs_build = false;
+        
+        const char *path = pass->shader.path;
+        source_t source;
+        if(!source_load(data->sources, path, &source)) {
+            fprintf(stderr, "could not open shader source `%s`\n", path);
+            continue;
+        }
+        if(source.file_count > 1) {
+            fprintf(stderr, "loaded fragment shader source `%s` and %d include%s\n",
+                    path, source.file_count - 1, source.file_count == 2 ? "" : "s");
+        } else {
+            fprintf(stderr, "loaded fragment shader source `%s`\n", path);
+        }
+        track_includes(data, &pass->shader, &source);
+        
+        // The user's source goes in as mapped pieces between our prologue and epilogue.
+        const char *frag[source.count + 2];
+        GLint lengths[source.count + 2];
+        frag[0] = frag_defines;
+        lengths[0] = -1;
+        memcpy(frag + 1, source.strings, source.count * sizeof(const char *));
+        memcpy(lengths + 1, source.lengths, source.count * sizeof(GLint));
+        frag[source.count + 1] = frag_shader;
+        lengths[source.count + 1] = -1;
+        const char *vert[] = {vert_shader};
+        
+        // The source's hash covers every file that went into it, so there's no need to hash the
+        // text again.
+        const char *sources[] = {vert_shader, frag_defines, frag_shader};
+        data->build_key = progcache_key(sources, 3);
+        data->build_key = hash_bytes(data->build_key, &source.hash, sizeof(source.hash));
+        
+        // Saving a file without changing it, or touching one of its includes, needs no build.
+        if(pass->shader.prog && pass->shader.key == data->build_key) {
+            fprintf(stderr, "shader `%s` is unchanged, keeping its program\n", path);
+            source_free(&source);
+            continue;
+        }
+        
+        if(data->cache_dir) {
+            double start = timer_now();
+            double compile_ms = 0;
+            GLuint prog = progcache_load(data->cache_dir, data->build_key, &compile_ms);
+            if(prog) {
+                double load_ms = (timer_now() - start) * 1e3;
+                fprintf(stderr, "program cache hit: loaded in %.1f ms, saved %.1f ms\n",
+                        load_ms, compile_ms - load_ms);
+                install_program(data, i, prog, data->build_key);
+                source_free(&source);
+                continue;
+            }
+        }
+        
+        data->building = i;
+        compiler_start(data->compiler, vert, NULL, 1, frag, lengths, source.count + 2, data->cache_dir != NULL);
+        source_free(&source);
+    }
+}
+
+// Describes one step of a build for the log: its time, "cached", or "n/a" when it wasn't timed.
+static void format_step(char *out, size_t size, bool cached, double ms) {
+    if(cached) snprintf(out, size, "cached");
+    else if(isnan(ms)) snprintf(out, size, "n/a");
+    else snprintf(out, size, "%.1f ms", ms);
+}
+
+// Installs the program from a finished background build, if there is one, and starts on the next
+// pass waiting for a build. With `wait`, blocks until every queued build is done.
+static void poll_builds(shades_data_t *data, bool wait) {
+    for(;;) {
+        build_state_t state = compiler_poll(data->compiler, wait);
+        if(state == BUILD_RUNNING) return;
+        
+        if(state != BUILD_IDLE) {
+            build_times_t times;
+            GLuint prog = compiler_take(data->compiler, &times);
+            pass_info_t *pass = &data->passes[data->building];
+            
+            if(pass->needs_build) {
+                // The source changed again while we were building, so this result is already stale.
+                if(prog) glDeleteProgram(prog);
+            } else if(!prog) {
+                if(pass->shader.prog) fprintf(stderr, "shader build failed, keeping previous program\n");
+            } else {
+                char vert[32], frag[32], link[32];
+                format_step(vert, sizeof(vert), times.vert_cached, times.vert_ms);
+                format_step(frag, sizeof(frag), times.frag_cached, times.frag_ms);
+                format_step(link, sizeof(link), false, times.link_ms);
+                
+                fprintf(stderr, "%scompiled program in %.1f ms (vertex %s, fragment %s, link %s)\n",
+                        data->cache_dir ? "program cache miss: " : "", times.total_ms, vert, frag, link);
+                if(data->cache_dir) progcache_store(data->cache_dir, data->build_key, prog, times.total_ms);
+                install_program(data, data->building, prog, data->build_key);
+            }
+            data->building = -1;
+        }
+        
+        start_next_build(data);
+        if(compiler_poll(data->compiler, false) == BUILD_IDLE) return;
+        if(!wait) return;
+    }
+}
+
+static void reload_shaders(shades_data_t *data) {
+    for(int i = 0; i < data->graph.count; ++i) data->passes[i].needs_build = true;
+    poll_builds(data, false);
+}
+
+static void load_shaders(shades_data_t *data) {
+    for(int i = 0; i < data->graph.count; ++i) data->passes[i].needs_build = true;
+    poll_builds(data, true);
+}
+
+static void bind_framebuffer(shades_data_t *data, GLuint fbo, int width, int height) {
+    if(data->bound.fbo != fbo) {
+        COUNT_GL(data, glBindFramebuffer(GL_FRAMEBUFFER, fbo));
+        data->bound.fbo = fbo;
+    }
+    if(data->bound.width != width || data->bound.height != height) {
+        COUNT_GL(data, glViewport(0, 0, width, height));
+        data->bound.width = width;
+        data->bound.height = height;
+    }
+}
+
+// Logical rendering is only exact when each logical pixel covers a whole number of physical ones.
+static int logical_scale(const shades_data_t *data) {
+    if(!data->logical || data->scale < 2.f || data->scale != floorf(data->scale)) return 1;
+    return (int)data->scale;
+}
+
+// Works out the size the screen pass should render at this frame, and (re)creates the internal
+// target when it changed. Logical targets are rounded up and top-aligned on the screen like
+// u_scale's coordinates are; dynamic resolution targets are stretched over the whole screen.
+static void update_internal(shades_data_t *data) {
+    int width = 0, height = 0;
+    float scale_x = 1.f, scale_y = 1.f;
+    GLenum filter = GL_NEAREST;
+    int logical = logical_scale(data);
+    
+    if(data->use_dynres && data->dynres.scale < 1.f) {
+        width = (int)ceilf(data->size.x * data->dynres.scale);
+        height = (int)ceilf(data->size.y * data->dynres.scale);
+        if(width < 1) width = 1;
+        if(height < 1) height = 1;
+        scale_x = data->size.x / width;
+        scale_y = data->size.y / height;
+        filter = GL_LINEAR;
+    } else if(logical > 1) {
+        width = (int)ceilf(data->size.x / logical);
+        height = (int)ceilf(data->size.y / logical);
+        scale_x = scale_y = logical;
+    }
+    
+    data->perf.width = width ? width : data->size.x;
+    data->perf.height = height ? height : data->size.y;
+    if(width == data->internal.width && height == data->internal.height
+       && scale_x == data->internal.scale_x && scale_y == data->internal.scale_y) return;
+    
+    data->internal.scale_x = scale_x;
+    data->internal.scale_y = scale_y;
+    data->internal.filter = filter;
+    if(width == data->internal.width && height == data->internal.height) return;
+    
+    if(data->internal.fbo) {
+        glDeleteFramebuffers(1, &data->internal.fbo);
+        glDeleteTextures(1, &data->internal.tex);
+        data->internal.fbo = data->internal.tex = 0;
+    }
+    data->internal.width = width;
+    data->internal.height = height;
+    if(!width) return;
+    
+    data->internal.tex = gl_create_tex(width, height);
+    data->internal.fbo = gl_create_fbo(data->internal.tex);
+    if(!data->internal.fbo) die("could not create internal render target");
+    invalidate_bindings(data);
+}
+
+static void fini_targets(shades_data_t *data) {
+    fini_uniforms(data);
+    graph_fini(&data->graph);
+    data->logical = false;
+    data->use_dynres = false;
+    update_internal(data);
+}
+
+// Presents the internal target on the screen. Logical targets use nearest filtering: blits from
+// integer scales are exact, so this matches rendering every physical pixel for shaders that snap
+// to u_scale. Dynamic resolution is upsampled bilinearly.
+static void present_internal(shades_data_t *data) {
+    int width = (int)lroundf(data->internal.width * data->internal.scale_x);
+    int height = (int)lroundf(data->internal.height * data->internal.scale_y);
+    int top = data->size.y;
+    
+    COUNT_GL(data, glBindFramebuffer(GL_DRAW_FRAMEBUFFER, data->screen));
+    COUNT_GL(data, glBlitFramebuffer(0, 0, data->internal.width, data->internal.height,
+                                     0, top - height, width, top,
+                                     GL_COLOR_BUFFER_BIT, data->internal.filter));
+    data->bound.fbo = UNBOUND;
+}
+
+static void bind_program(shades_data_t *data, GLuint prog) {
+    if(data->bound.prog == prog) return;
+    COUNT_GL(data, glUseProgram(prog));
+    data->bound.prog = prog;
+}
+
+static void bind_texture(shades_data_t *data, int unit, GLuint tex) {
+    if(data->bound.tex[unit] == tex) return;
+    if(data->bound.unit != (GLuint)unit) {
+        COUNT_GL(data, glActiveTexture(GL_TEXTURE0 + unit));
+        data->bound.unit = unit;
+    }
+    COUNT_GL(data, glBindTexture(GL_TEXTURE_2D, tex));
+    data->bound.tex[unit] = tex;
+}
+
+static GLuint input_texture(const shades_data_t *data, const graph_input_t *in, vect2_t *size) {
+    switch(in->kind) {
+    case INPUT_IMAGE:
+        if(!data->textures[in->index].tex) {
+            *size = VECT2(1, 1);
+            return data->placeholder;
+        }
+        *size = data->textures[in->index].size;
+        return data->textures[in->index].tex;
+    case INPUT_PASS:
+        *size = VECT2(data->graph.width, data->graph.height);
+        return graph_output(&data->graph, in->index);
+    default:
+        *size = VECT2(0, 0);
+        return 0;
+    }
+}
+
+// Fills in every built-in uniform for this frame, and uploads them in a single write if anything
+// changed since the last one.
+static void update_uniforms(shades_data_t *data) {
+    uint8_t *next = data->uniforms.next;
+    const size_t *offsets = data->uniforms.offsets;
+    
+    frame_block_t *frame = (frame_block_t *)(next + offsets[BLOCK_FRAME]);
+    *frame = (frame_block_t){.res = {data->size.x, data->size.y}, .scale = data->scale};
+    time_block_t *time = (time_block_t *)(next + offsets[BLOCK_TIME]);
+    *time = (time_block_t){.time = (float)data->time};
     
-    glUniform2fv(data->shader.uniform.res, 1, (const float *)&data->size);
-    glUniform1f(data->shader.uniform.time, (float)glfwGetTime());
-    glUniform1f(data->shader.uniform.scale, data->scale);
+    for(int i = 0; i < data->graph.count; ++i) {
+        size_t base = i * data->uniforms.stride;
+        pass_block_t *pass = (pass_block_t *)(next + offsets[BLOCK_PASS] + base);
+        inputs_block_t *inputs = (inputs_block_t *)(next + offsets[BLOCK_INPUTS] + base);
+        
+        // The screen has its origin at the bottom, everything else at the top. The internal target
+        // is the screen, shrunk down: each fragment stands for the centre of a block of pixels.
+        bool screen = i == data->graph.count - 1;
+        bool internal = screen && data->internal.fbo;
+        float sx = internal ? data->internal.scale_x : 1.f;
+        float sy = internal ? data->internal.scale_y : 1.f;
+        float height = internal ? data->internal.height : data->size.y;
+        *pass = (pass_block_t){{sx, screen ? -sy : sy, 0.f, screen ? sy * height : 0.f}};
+        if(screen && data->tiled) {
+            const tile_t *tile = &data->tile;
+            *pass = (pass_block_t){{1.f, -1.f, tile->x, tile->y + tile->height}};
+        }
+        
+        *inputs = (inputs_block_t){0};
+        for(int j = 0; j < MAX_TEXTURES; ++j) {
+            vect2_t size;
+            input_texture(data, &data->graph.passes[i].inputs[j], &size);
+            inputs->tex_res[j][0] = size.x;
+            inputs->tex_res[j][1] = size.y;
+        }
+    }
     
-    // printf("size: %.0fx%.0f (%.0fX)\n", data->size.x, data->size.y, data->scale);
+    size_t size = data->uniforms.size;
+    if(data->uniforms.valid && !memcmp(next, data->uniforms.uploaded, size)) return;
+    data->uniforms.next = data->uniforms.uploaded;
+    data->uniforms.uploaded = next;
+    data->uniforms.valid = true;
+    COUNT_GL(data, glBindBuffer(GL_UNIFORM_BUFFER, data->uniforms.ubo));
+    COUNT_GL(data, glBufferSubData(GL_UNIFORM_BUFFER, 0, size, next));
+}
+
+static void bind_pass_uniforms(shades_data_t *data, int index) {
+    if(data->bound.blocks == index) return;
+    size_t base = index * data->uniforms.stride;
+    const size_t *offsets = data->uniforms.offsets;
+    COUNT_GL(data, glBindBufferRange(GL_UNIFORM_BUFFER, BLOCK_PASS, data->uniforms.ubo,
+                                     offsets[BLOCK_PASS] + base, sizeof(pass_block_t)));
+    COUNT_GL(data, glBindBufferRange(GL_UNIFORM_BUFFER, BLOCK_INPUTS, data->uniforms.ubo,
+                                     offsets[BLOCK_INPUTS] + base, sizeof(inputs_block_t)));
+    data->bound.blocks = index;
+}
+
+static void run_pass(shades_data_t *data, int index, GLuint fbo, int width, int height) {
+    const shader_info_t *shader = &data->passes[index].shader;
+    const graph_pass_t *node = &data->graph.passes[index];
     
-    vect2_t tex_res[MAX_TEXTURES];
+    bind_framebuffer(data, fbo, width, height);
+    bind_program(data, shader->prog);
+    bind_pass_uniforms(data, index);
     
     for(int i = 0; i < MAX_TEXTURES; ++i) {
-        glActiveTexture(GL_TEXTURE0+i);
-        glBindTexture(GL_TEXTURE_2D, data->textures[i].tex);
-        tex_res[i] = data->textures[i].size;
+        vect2_t size;
+        bind_texture(data, i, input_texture(data, &node->inputs[i], &size));
+    }
+    
+    if(!shader->prog) {
+        // Nothing to draw with, but don't leave the previous frame's garbage around.
+        COUNT_GL(data, glClear(GL_COLOR_BUFFER_BIT));
+    } else if(index == data->graph.count - 1) {
+        // The draw timer measures the screen pass's draw alone, not the passes feeding it.
+        gpu_timer_begin_draw(&data->perf.timer);
+        COUNT_GL(data, glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0));
+        gpu_timer_end_draw(&data->perf.timer);
+    } else {
+        COUNT_GL(data, glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0));
+    }
+}
+
+// A pass can reuse last frame's output when it has one, isn't animated, and none of its inputs
+// changed since.
+static bool can_skip(const shades_data_t *data, int index) {
+    const pass_info_t *pass = &data->passes[index];
+    const graph_pass_t *node = &data->graph.passes[index];
+    if(!node->persistent || node->feedback || !node->output) return false;
+    if(!pass->valid) return false;
+    
+    for(int i = 0; i < MAX_TEXTURES; ++i) {
+        const graph_input_t *in = &node->inputs[i];
+        if(in->kind == INPUT_PASS && data->passes[in->index].rendered) return false;
+    }
+    return true;
+}
+
+static void run_loop(shades_data_t *data) {
+    graph_t *graph = &data->graph;
+    data->perf.gl_calls = 0;
+    
+    update_uniforms(data);
+    for(int pos = 0; pos < graph->count; ++pos) {
+        int index = graph->order[pos];
+        pass_info_t *pass = &data->passes[index];
+        pass->rendered = false;
+        
+        if(index == graph->count - 1 && data->internal.fbo) {
+            run_pass(data, index, data->internal.fbo, data->internal.width, data->internal.height);
+            present_internal(data);
+        } else if(index == graph->count - 1 && data->tiled) {
+            run_pass(data, index, data->screen, data->tile.width, data->tile.height);
+        } else if(index == graph->count - 1) {
+            run_pass(data, index, data->screen, data->size.x, data->size.y);
+        } else if(can_skip(data, index)) {
+            graph_finish_pass(graph, pos);
+            continue;
+        } else {
+            if(graph_prepare_pass(graph, index)) invalidate_bindings(data);
+            run_pass(data, index, graph_pass_fbo(graph, index), data->size.x, data->size.y);
+        }
+        
+        pass->rendered = true;
+        pass->valid = true;
+        graph_finish_pass(graph, pos);
+    }
+}
+
+static bool perf_init(perf_t *perf, const char *csv_path, size_t window) {
+    gpu_timer_init(&perf->timer);
+    stats_init(&perf->cpu_ms, window);
+    stats_init(&perf->frame_ms, window);
+    stats_init(&perf->draw_ms, window);
+    perf->last_report = timer_now();
+    perf->enabled = true;
+    
+    if(!csv_path) return true;
+    perf->csv = strcmp(csv_path, "-") ? fopen(csv_path, "w") : stdout;
+    if(!perf->csv) {
+        fprintf(stderr, "could not open `%s` for writing\n", csv_path);
+        return false;
+    }
+    fprintf(perf->csv, "frame,gpu_frame_ms,gpu_draw_ms\n");
+    return true;
+}
+
+static void print_summary(const char *name, const stats_t *stats) {
+    stats_summary_t s = stats_summary(stats);
+    fprintf(stderr, "%s min %.3f avg %.3f p50 %.3f p99 %.3f ms", name, s.min, s.avg, s.p50, s.p99);
+}
+
+static void perf_report(const perf_t *perf) {
+    print_summary("gpu frame", &perf->frame_ms);
+    fprintf(stderr, " | ");
+    print_summary("draw", &perf->draw_ms);
+    fprintf(stderr, " | %dx%d", perf->width, perf->height);
+    fprintf(stderr, " | %u gl calls (%zu frames", perf->gl_calls, perf->frame_ms.count);
+    if(perf->timer.dropped) fprintf(stderr, ", %ld unmeasured", perf->timer.dropped);
+    fprintf(stderr, ")\n");
+}
+
+// Reads back finished GPU timings. When `dynres` isn't NULL, it is fed every sample, and the
+// resolution it picks applies from `next_frame` on.
+static void perf_collect(perf_t *perf, dynres_t *dynres, long next_frame, bool wait) {
+    gpu_sample_t sample;
+    while(gpu_timer_poll(&perf->timer, &sample, wait)) {
+        if(dynres && dynres_update(dynres, sample.frame, sample.frame_ms, next_frame)) {
+            fprintf(stderr, "dynamic resolution: %.1f ms over %.1f ms budget, rendering at %.0f%%\n",
+                    dynres->avg_ms, dynres->budget_ms, dynres->scale * 100.f);
+        }
+        if(sample.frame < perf->measure_from) continue;
+        stats_push(&perf->frame_ms, sample.frame_ms);
+        stats_push(&perf->draw_ms, sample.draw_ms);
+        if(perf->csv) {
+            fprintf(perf->csv, "%ld,%.6f,%.6f\n", sample.frame, sample.frame_ms, sample.draw_ms);
+        }
     }
+}
+
+static void perf_fini(perf_t *perf) {
+    if(!perf->enabled) return;
+    perf_collect(perf, NULL, 0, true);
+    if(perf->report) perf_report(perf);
+    
+    if(perf->csv && perf->csv != stdout) fclose(perf->csv);
+    gpu_timer_fini(&perf->timer);
+    stats_fini(&perf->cpu_ms);
+    stats_fini(&perf->frame_ms);
+    stats_fini(&perf->draw_ms);
+    perf->enabled = false;
+}
+
+static void render_frame(shades_data_t *data) {
+    perf_t *perf = &data->perf;
+    poll_builds(data, false);
+    poll_textures(data, false);
+    update_internal(data);
+    if(perf->enabled) gpu_timer_begin_frame(&perf->timer, data->frame);
     
-    glUniform2fv(data->shader.uniform.tex_res, MAX_TEXTURES, (const float *)tex_res);
+    run_loop(data);
     
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    data->frame += 1;
+    if(!perf->enabled) return;
+    gpu_timer_end_frame(&perf->timer);
+    perf_collect(perf, data->use_dynres ? &data->dynres : NULL, data->frame, false);
+    
+    double now = timer_now();
+    if(perf->report && now - perf->last_report >= 1.0) {
+        perf_report(perf);
+        perf->last_report = now;
+    }
+}
+
+// Whether the picture changes on its own: a program reads u_time, or a pass reads its own output.
+static bool is_animated(const shades_data_t *data) {
+    for(int i = 0; i < data->graph.count; ++i) {
+        const pass_info_t *pass = &data->passes[i];
+        if(!pass->shader.prog) continue;
+        if(!pass->is_static || data->graph.passes[i].feedback) return true;
+    }
+    return false;
+}
+
+// Whether the window shows anything out of date. Installing a program, loading an image or changing
+// a built-in uniform all invalidate the passes involved.
+static bool needs_frame(const shades_data_t *data) {
+    if(data->redraw || is_animated(data)) return true;
+    for(int i = 0; i < data->graph.count; ++i) {
+        if(!data->passes[i].valid) return true;
+    }
+    return false;
+}
+
+static bool has_pending_work(const shades_data_t *data) {
+    return data->building >= 0 || texload_pending(data->loader) > 0 || uploader_busy(data->uploader);
+}
+
+// Sleeps until something happens. Builds, image loads and file changes don't post window events,
+// so while any of those could happen we only sleep for a bit.
+static void wait_idle(const shades_data_t *data) {
+    if(has_pending_work(data)) {
+        glfwWaitEventsTimeout(IDLE_WORK_POLL);
+    } else if(data->watch) {
+        glfwWaitEventsTimeout(IDLE_WATCH_POLL);
+    } else {
+        glfwWaitEvents();
+    }
+}
+
+// Processes events until the next frame is due, `period` seconds after the last one. Deadlines are
+// kept on a fixed grid so the rate doesn't drift, unless we fall behind it.
+static void pace_frame(double *deadline, double period) {
+    double now = glfwGetTime();
+    *deadline += period;
+    if(*deadline < now) *deadline = now;
     
-    glBindVertexArray(0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glUseProgram(0);
+    glfwPollEvents();
+    for(double left = *deadline - glfwGetTime(); left > 0; left = *deadline - glfwGetTime()) {
+        glfwWaitEventsTimeout(left);
+    }
 }
 
 static void usage(const char *prog, FILE *out, bool detailed) {
-    fprintf(out, "Usage: %s [-h] [-s <size>] <shader.glsl> [<texture.png>...]\n", prog);
+    fprintf(out, "Usage: %s [-h] [-s <size>] [options] <shader.glsl> [<texture.png>...]\n", prog);
     if(!detailed) return;
     
 #ifdef __APPLE__
@@ -242,6 +1152,7 @@ static void usage(const char *prog, FILE *out, bool detailed) {
     "  %sR      reload currently loaded shaders and textures.\n"
     "  %s+      increase the zoom level by 1.\n"
     "  %s-      decrease the zoom level by 1.\n"
+    "  %sL      toggle logical resolution rendering.\n"
     "\n"
     "Examples\n"
     "  Run the `crt.glsl' fragment shader, with `image.png'\n"
@@ -250,10 +1161,74 @@ static void usage(const char *prog, FILE *out, bool detailed) {
     "\n"
     "  $ %s crt.glsl -s 1024x800 image.png mask.png\n"
     "\n"
+    "  Render the first ten seconds of `crt.glsl' at 30fps\n"
+    "  without opening a window, and save the last frame.\n"
+    "\n"
+    "  $ %s --headless -s 1920x1080 -t 0:10 --fps 30 -o last.ppm crt.glsl\n"
+    "\n"
+    "  Run `blur.glsl' on `image.png' into buffer 0, then\n"
+    "  show it with `crt.glsl'. Buffer 1 reads its own\n"
+    "  output from the previous frame in u_tex0.\n"
+    "\n"
+    "  $ %s -p blur.glsl:image.png -p trail.glsl:@1,@0 crt.glsl @0 @1\n"
+    "\n"
     "Options\n"
-    " -s <size> specify a starting window size in points.\n"
-    " -h        shows this help screen and exists.\n",
-    CMD_CHAR,CMD_CHAR,CMD_CHAR,prog);
+    " -s <size>         specify a starting window size in points, or the size\n"
+    "                   of the render target in pixels with --headless.\n"
+    " -h                shows this help screen and exists.\n"
+    " --headless        render offscreen without opening a window.\n"
+    " -n <frames>       stop after rendering <frames> frames.\n"
+    " -t <start>[:<end>]\n"
+    "                   time range to render offscreen, in seconds.\n"
+    " --fps <rate>      offscreen frame rate used to step u_time (default %d).\n"
+    " --max-fps <rate>  cap the window's frame rate for animated shaders. Static\n"
+    "                   shaders only render when something changes.\n"
+    " --scale <zoom>    initial value of u_scale.\n"
+    " -o <file>         save the last offscreen frame as a PPM image, or as a\n"
+    "                   PNG if <file> ends in .png.\n"
+    " --tile <size>     render the -o image in tiles of at most <size> pixels\n"
+    "                   square, streamed to the file a row of tiles at a time,\n"
+    "                   for images larger than the GPU can render at once.\n"
+    " --capture <file>  stream every offscreen frame to <file> (`-' for stdout)\n"
+    "                   as raw video that ffmpeg can read.\n"
+    " --capture-format <format>\n"
+    "                   y4m (YUV 4:4:4, the default), rgba (raw frames), or\n"
+    "                   png: one file per frame, named by the single %%d in\n"
+    "                   <file> (e.g. out/%%04d.png).\n"
+    " --capture-threads <n>\n"
+    "                   PNG encoder threads (default: one per CPU).\n"
+    " --stats           print rolling GPU frame and draw times to stderr.\n"
+    " --stats-csv <file>\n"
+    "                   write per-frame GPU times as CSV (`-' for stdout).\n"
+    " --bench <frames>  render <frames> frames with vsync off and a fixed u_time\n"
+    "                   step, then print throughput and frame time percentiles.\n"
+    " --warmup <frames> frames rendered before measuring (default %d).\n"
+    " --cache-dir <dir> where to cache compiled shader programs and decoded images\n"
+    "                   (default $XDG_CACHE_HOME/shades or ~/.cache/shades).\n"
+    " --no-cache        always compile shaders and decode images from source.\n"
+    " -l, --logical     when u_scale is a whole number, render one fragment per\n"
+    "                   u_scale-sized block and scale the result up. Exact for\n"
+    "                   shaders that snap coordinates to whole pixels.\n"
+    " --budget <ms>     lower the screen pass's resolution when the GPU takes\n"
+    "                   longer than <ms> per frame, and raise it back when\n"
+    "                   there is room. Upscales bilinearly.\n"
+    " --min-res <frac>  smallest fraction of the window size to render at with\n"
+    "                   --budget (default %.2f).\n"
+    " --max-res <frac>  largest fraction of the window size (default 1).\n"
+    " --sampler <n>=<option>,...\n"
+    "                   how every pass samples u_tex<n>: nearest, linear or\n"
+    "                   mipmap filtering, repeat, clamp or mirror wrapping,\n"
+    "                   and aniso=<level> (default nearest,repeat).\n"
+    " --compress <n>=<format>\n"
+    "                   block-compress images read as u_tex<n> when they're\n"
+    "                   loaded: bc1 (RGB), bc4 (grey) or bc7 (RGBA).\n"
+    " -w, --watch       reload the shader and textures when they change on disk.\n"
+    " -p, --pass <shader.glsl>[:<input>,...]\n"
+    "                   render <shader.glsl> into buffer @N, where N counts\n"
+    "                   passes from 0. Inputs are texture paths or buffers,\n"
+    "                   and may be empty. A pass reading its own buffer sees\n"
+    "                   its output from the previous frame.\n",
+    CMD_CHAR,CMD_CHAR,CMD_CHAR,CMD_CHAR,prog,prog,prog,FPS,BENCH_WARMUP,DYNRES_MIN);
     
 }
 
@@ -262,10 +1237,57 @@ static void usage(const char *prog, FILE *out, bool detailed) {
 //     data->size = VECT2(width, height);
 // }
 
+static void init_watch(shades_data_t *data) {
+    data->watch = watch_new();
+    for(int i = 0; i < data->graph.count; ++i) {
+        shader_info_t *shader = &data->passes[i].shader;
+        shader->watch = watch_add(data->watch, shader->path);
+    }
+    for(int i = 0; i < data->num_includes; ++i) {
+        data->includes[i].watch = watch_add(data->watch, data->includes[i].path);
+    }
+    for(int i = 0; i < data->num_textures; ++i) {
+        texture_info_t *texture = &data->textures[i];
+        texture->watch = watch_add(data->watch, texture->path);
+    }
+}
+
+// Reloads whatever changed on disk since the last call. Textures that didn't change are left alone.
+static void poll_watch(shades_data_t *data) {
+    if(!data->watch || !watch_poll(data->watch)) return;
+    
+    for(int i = 0; i < data->num_includes; ++i) {
+        include_info_t *include = &data->includes[i];
+        include->changed = include->watch >= 0 && watch_changed(data->watch, include->watch);
+    }
+    for(int i = 0; i < data->graph.count; ++i) {
+        pass_info_t *pass = &data->passes[i];
+        if(watch_changed(data->watch, pass->shader.watch)) pass->needs_build = true;
+        for(int j = 0; j < pass->shader.num_includes; ++j) {
+            if(data->includes[pass->shader.includes[j]].changed) pass->needs_build = true;
+        }
+    }
+    poll_builds(data, false);
+    reload_textures(data, true);
+}
+
 static void framebuffer_callback(GLFWwindow *window, int width, int height) {
     shades_data_t *data = glfwGetWindowUserPointer(window);
     data->size = VECT2(width, height);
-    glViewport(0, 0, width, height);
+    graph_resize(&data->graph, width, height);
+    mark_passes(data);
+    invalidate_bindings(data);
+}
+
+// The window's contents were damaged, or it is back on screen.
+static void refresh_callback(GLFWwindow *window) {
+    shades_data_t *data = glfwGetWindowUserPointer(window);
+    data->redraw = true;
+}
+
+static void iconify_callback(GLFWwindow *window, int iconified) {
+    shades_data_t *data = glfwGetWindowUserPointer(window);
+    if(!iconified) data->redraw = true;
 }
 
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
@@ -277,22 +1299,25 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
     shades_data_t *data = glfwGetWindowUserPointer(window);
     switch(key) {
     case GLFW_KEY_R:
-        data->shader.prog = reload_shader(data->shader.prog, data->shader.path);
-        fetch_shader_info(data);
-        for(int i = 0; i < MAX_TEXTURES; ++i) {
-            const char *path = data->textures[i].path;
-            if(!path) continue;
-            data->textures[i].tex = reload_texture(data->textures[i].tex, path, &data->textures[i].size);
-        }
+        reload_shaders(data);
+        reload_textures(data, false);
         break;
         
     case GLFW_KEY_EQUAL:
         data->scale += 1.f;
+        mark_passes(data);
         break;
         
     case GLFW_KEY_MINUS:
         data->scale -= 1.f;
         if(data->scale < 1.f) data->scale = 1.f;
+        mark_passes(data);
+        break;
+        
+    case GLFW_KEY_L:
+        data->logical = !data->logical;
+        data->redraw = true;
+        fprintf(stderr, "logical resolution rendering %s\n", data->logical ? "on" : "off");
         break;
     default: break;
     }
@@ -304,6 +1329,70 @@ static void exit_usage(const char *prog, const char *message) {
     exit(EXIT_FAILURE);
 }
 
+static bool parse_range(char *arg, double *start, double *end) {
+    assert(start && end);
+    char *sep = strchr(arg, ':');
+    if(sep) *sep = '\0';
+    
+    char *last = NULL;
+    *start = strtod(arg, &last);
+    if(last == arg || *last) return false;
+    if(!sep) return true;
+    
+    const char *e = sep+1;
+    *end = strtod(e, &last);
+    return last != e && !*last && *end >= *start;
+}
+
+// Parses `<channel>=bc1|bc4|bc7`.
+static bool parse_compress(const char *arg, GLenum *compress) {
+    char *end = NULL;
+    long channel = strtol(arg, &end, 10);
+    if(end == arg || *end != '=' || channel < 0 || channel >= MAX_TEXTURES) return false;
+    compress[channel] = bcenc_parse(end + 1);
+    return compress[channel] != 0;
+}
+
+// Parses `<channel>=<option>,...`, where options pick a filter, a wrap mode and anisotropy.
+static bool parse_sampler(char *arg, sampler_spec_t *specs) {
+    char *end = NULL;
+    long channel = strtol(arg, &end, 10);
+    if(end == arg || *end != '=' || channel < 0 || channel >= MAX_TEXTURES) return false;
+    
+    sampler_spec_t *spec = &specs[channel];
+    *spec = (sampler_spec_t){
+        .set = true,
+        .min_filter = GL_NEAREST,
+        .mag_filter = GL_NEAREST,
+        .wrap = GL_REPEAT,
+        .anisotropy = 1.f,
+    };
+    
+    char *save = NULL;
+    for(char *opt = strtok_r(end + 1, ",", &save); opt; opt = strtok_r(NULL, ",", &save)) {
+        if(!strcmp(opt, "nearest")) {
+            spec->min_filter = spec->mag_filter = GL_NEAREST;
+        } else if(!strcmp(opt, "linear")) {
+            spec->min_filter = spec->mag_filter = GL_LINEAR;
+        } else if(!strcmp(opt, "mipmap")) {
+            spec->min_filter = GL_LINEAR_MIPMAP_LINEAR;
+            spec->mag_filter = GL_LINEAR;
+        } else if(!strcmp(opt, "repeat")) {
+            spec->wrap = GL_REPEAT;
+        } else if(!strcmp(opt, "clamp")) {
+            spec->wrap = GL_CLAMP_TO_EDGE;
+        } else if(!strcmp(opt, "mirror")) {
+            spec->wrap = GL_MIRRORED_REPEAT;
+        } else if(!strncmp(opt, "aniso=", 6)) {
+            spec->anisotropy = atof(opt + 6);
+            if(!(spec->anisotropy >= 1.f)) return false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
 static bool parse_size(char *arg, double *width, double *height) {
     char *sep = strchr(arg, 'x');
     
@@ -318,6 +1407,433 @@ static bool parse_size(char *arg, double *width, double *height) {
     return true;
 }
 
+static bool is_png(const char *path) {
+    size_t length = strlen(path);
+    return length >= 4 && (!strcmp(path + length - 4, ".png") || !strcmp(path + length - 4, ".PNG"));
+}
+
+// Saves the read framebuffer as a PNG if `path` ends in .png, and as a PPM otherwise.
+static void save_image(const char *path, int width, int height) {
+    size_t pitch = (size_t)width * 4;
+    uint8_t *pixels = malloc(pitch * height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    
+    if(is_png(path)) {
+        // GL reads bottom-up, PNG is top-down.
+        uint8_t *row = malloc(pitch);
+        for(int y = 0; y < height / 2; ++y) {
+            uint8_t *top = pixels + y * pitch, *bottom = pixels + (height - 1 - y) * pitch;
+            memcpy(row, top, pitch);
+            memcpy(top, bottom, pitch);
+            memcpy(bottom, row, pitch);
+        }
+        if(png_write(path, pixels, width, height)) {
+            fprintf(stderr, "saved frame to `%s` (%dx%d)\n", path, width, height);
+        }
+        free(row);
+        free(pixels);
+        return;
+    }
+    
+    FILE *f = fopen(path, "wb");
+    if(!f) {
+        fprintf(stderr, "could not open `%s` for writing\n", path);
+        free(pixels);
+        return;
+    }
+    
+    // GL reads bottom-up, PPM is top-down.
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    for(int y = height-1; y >= 0; --y) {
+        const uint8_t *row = pixels + (size_t)y * width * 4;
+        for(int x = 0; x < width; ++x) {
+            fwrite(row + x * 4, 1, 3, f);
+        }
+    }
+    fclose(f);
+    free(pixels);
+    fprintf(stderr, "saved frame to `%s` (%dx%d)\n", path, width, height);
+}
+
+typedef struct {
+    double          width;
+    double          height;
+    float           scale;
+    
+    bool            headless;
+    long            frames;
+    double          start;
+    double          end;
+    double          fps;
+    double          max_fps;
+    const char      *output;
+    const char      *capture;
+    capture_format_t capture_format;
+    int             capture_threads;
+    int             tile;
+    
+    bool            stats;
+    const char      *stats_csv;
+    
+    long            bench;
+    long            warmup;
+    
+    const char      *cache_dir;
+    bool            no_cache;
+    bool            watch;
+    bool            logical;
+    
+    double          budget;
+    float           min_res;
+    float           max_res;
+    
+    sampler_spec_t  samplers[MAX_TEXTURES];
+    GLenum          compress[MAX_TEXTURES];
+    
+    char            *passes[GRAPH_MAX_PASSES - 1];
+    int             num_passes;
+} options_t;
+
+static int add_image(shades_data_t *data, const char *prog, const char *path) {
+    for(int i = 0; i < data->num_textures; ++i) {
+        if(!strcmp(data->textures[i].path, path)) return i;
+    }
+    if(data->num_textures >= MAX_IMAGES) exit_usage(prog, "too many textures");
+    data->textures[data->num_textures].path = path;
+    return data->num_textures++;
+}
+
+static void parse_input(shades_data_t *data, const char *prog, const char *spec, graph_input_t *in) {
+    if(!*spec) {
+        in->kind = INPUT_NONE;
+    } else if(spec[0] == '@') {
+        char *end = NULL;
+        long index = strtol(spec + 1, &end, 10);
+        if(end == spec + 1 || *end || index < 0 || index >= data->graph.count - 1) {
+            exit_usage(prog, "invalid buffer reference");
+        }
+        in->kind = INPUT_PASS;
+        in->index = index;
+    } else {
+        in->kind = INPUT_IMAGE;
+        in->index = add_image(data, prog, spec);
+    }
+}
+
+// Buffer passes come from `-p <shader>:<inputs>`, and render in whichever order their inputs need.
+// The positional shader is always the last pass, and renders to the screen.
+static void init_graph(shades_data_t *data, options_t *opts, const char *prog,
+                       const char *shader, const char **inputs, int num_inputs) {
+    graph_t *graph = &data->graph;
+    graph->count = opts->num_passes + 1;
+    
+    for(int i = 0; i < opts->num_passes; ++i) {
+        char *spec = opts->passes[i];
+        char *list = strchr(spec, ':');
+        if(list) *list++ = '\0';
+        data->passes[i].shader.path = spec;
+        
+        for(int j = 0; list; ++j) {
+            if(j >= MAX_TEXTURES) exit_usage(prog, "too many inputs for a pass");
+            char *next = strchr(list, ',');
+            if(next) *next++ = '\0';
+            parse_input(data, prog, list, &graph->passes[i].inputs[j]);
+            list = next;
+        }
+    }
+    
+    int screen = graph->count - 1;
+    data->passes[screen].shader.path = shader;
+    for(int j = 0; j < num_inputs; ++j) {
+        parse_input(data, prog, inputs[j], &graph->passes[screen].inputs[j]);
+    }
+    
+    if(!graph_sort(graph)) exit_usage(prog, "passes depend on each other in a cycle");
+}
+
+static bool all_built(const shades_data_t *data) {
+    for(int i = 0; i < data->graph.count; ++i) {
+        if(!data->passes[i].shader.prog) return false;
+    }
+    return true;
+}
+
+static void print_bench_line(const char *name, const stats_t *stats) {
+    stats_summary_t s = stats_summary(stats);
+    fprintf(stderr, "  %-12s min %8.3f  avg %8.3f  p50 %8.3f  p99 %8.3f  max %8.3f ms\n",
+            name, s.min, s.avg, s.p50, s.p99, s.max);
+}
+
+// Renders a warmup phase followed by a measured phase, as fast as possible. `u_time` follows the same
+// fixed-step sequence in both phases, so every run renders exactly the same frames no matter how fast
+// the machine is, and the numbers only depend on the shader, the resolution and the GPU.
+static void run_bench(shades_data_t *data, const options_t *opts, GLFWwindow *window) {
+    perf_t *perf = &data->perf;
+    assert(perf->enabled);
+    
+    for(long i = 0; i < opts->warmup; ++i) {
+        data->time = opts->start + (double)i / opts->fps;
+        render_frame(data);
+        if(window) glfwSwapBuffers(window);
+        else glFlush();
+    }
+    glFinish();
+    perf_collect(perf, NULL, 0, true);
+    perf->measure_from = data->frame;
+    stats_reset(&perf->cpu_ms);
+    stats_reset(&perf->frame_ms);
+    stats_reset(&perf->draw_ms);
+    
+    double bench_start = timer_now();
+    double frame_start = bench_start;
+    for(long i = 0; i < opts->bench; ++i) {
+        data->time = opts->start + (double)i / opts->fps;
+        render_frame(data);
+        if(window) glfwSwapBuffers(window);
+        else glFlush();
+        
+        double now = timer_now();
+        stats_push(&perf->cpu_ms, (now - frame_start) * 1e3);
+        frame_start = now;
+    }
+    glFinish();
+    double total = timer_now() - bench_start;
+    perf_collect(perf, NULL, 0, true);
+    
+    fprintf(stderr, "bench: %s\n", (const char *)glGetString(GL_RENDERER));
+    fprintf(stderr, "  %ld frames at %.0fx%.0f, u_scale %.2f, u_time step 1/%g s, %ld warmup frames\n",
+            opts->bench, data->size.x, data->size.y, data->scale, opts->fps, opts->warmup);
+    fprintf(stderr, "  %.1f fps (%.3f s)\n", (double)opts->bench / total, total);
+    if(perf->width != data->size.x || perf->height != data->size.y) {
+        fprintf(stderr, "  screen pass rendered at %dx%d when done\n", perf->width, perf->height);
+    }
+    print_bench_line("cpu frame", &perf->cpu_ms);
+    print_bench_line("gpu frame", &perf->frame_ms);
+    print_bench_line("gpu draw", &perf->draw_ms);
+    fprintf(stderr, "  %u gl calls per steady-state frame\n", perf->gl_calls);
+    if(perf->timer.dropped) {
+        fprintf(stderr, "  warning: %ld frames could not be timed on the GPU\n", perf->timer.dropped);
+    }
+}
+
+// How many frames an offscreen run renders: -n, or the -t range at --fps, whichever is shorter.
+static long headless_frames(const options_t *opts) {
+    long frames = opts->frames;
+    if(!isnan(opts->end)) {
+        long range = (long)ceil((opts->end - opts->start) * opts->fps);
+        if(range < 1) range = 1;
+        if(frames <= 0 || range < frames) frames = range;
+    }
+    return frames > 0 ? frames : 1;
+}
+
+// The largest render target the driver can draw to in full, in either direction.
+static int max_target_size(void) {
+    GLint viewport[2] = {0, 0}, texture = 0;
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, viewport);
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &texture);
+    int size = viewport[0] < viewport[1] ? viewport[0] : viewport[1];
+    return texture < size ? texture : size;
+}
+
+// Renders the run's last frame a tile at a time, streaming it to -o's file. There is only a screen
+// pass, and it keeps nothing from one frame to the next, so the frames before it can be skipped.
+static bool run_tiled(shades_data_t *data, const options_t *opts) {
+    int width = data->size.x;
+    int height = data->size.y;
+    int tile_size = opts->tile;
+    int limit = max_target_size();
+    if(tile_size > limit) {
+        fprintf(stderr, "tiles can't be larger than %dx%d on this GPU\n", limit, limit);
+        tile_size = limit;
+    }
+    
+    tiler_t *tiler = tiler_new(opts->output, width, height, tile_size);
+    if(!tiler) return false;
+    GLuint tex = gl_create_tex(width < tile_size ? width : tile_size, height < tile_size ? height : tile_size);
+    GLuint fbo = gl_create_fbo(tex);
+    if(!fbo) die("could not create tile render target");
+    
+    data->screen = fbo;
+    data->tiled = true;
+    data->time = opts->start + (double)(headless_frames(opts) - 1) / opts->fps;
+    invalidate_bindings(data);
+    
+    bool ok = true;
+    while(ok && tiler_next(tiler, &data->tile)) {
+        render_frame(data);
+        ok = tiler_read(tiler, fbo);
+        data->bound.fbo = UNBOUND;
+        glFlush();
+    }
+    if(!tiler_delete(tiler)) ok = false;
+    data->tiled = false;
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &tex);
+    return ok;
+}
+
+// Offscreen rendering: no window, no swap chain, no vsync. `u_time` is stepped at a fixed rate
+// rather than read from the clock, so the same frame index always produces the same pixels.
+static int run_headless(shades_data_t *data, const options_t *opts) {
+    int width = data->size.x;
+    int height = data->size.y;
+    
+    if(opts->tile) {
+        bool ok = run_tiled(data, opts);
+        perf_fini(&data->perf);
+        return ok && all_built(data) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    int limit = max_target_size();
+    if(width > limit || height > limit) {
+        fprintf(stderr, "%dx%d is larger than this GPU can render at once (%dx%d); "
+                "save it with --tile and -o\n", width, height, limit, limit);
+        return EXIT_FAILURE;
+    }
+    
+    GLuint tex = gl_create_tex(width, height);
+    GLuint fbo = gl_create_fbo(tex);
+    if(!fbo) die("could not create offscreen render target");
+    
+    data->screen = fbo;
+    invalidate_bindings(data);
+    
+    bool ok = true;
+    if(opts->bench) {
+        run_bench(data, opts, NULL);
+    } else {
+        long frames = headless_frames(opts);
+        
+        // Captured frames are read back a few frames late, so rendering never waits for them.
+        capture_t *capture = NULL;
+        if(opts->capture) {
+            capture = capture_new(opts->capture, opts->capture_format, width, height, opts->fps,
+                                  opts->capture_threads);
+            if(!capture) ok = false;
+        }
+        
+        long rendered = 0;
+        for(; ok && rendered < frames; ++rendered) {
+            data->time = opts->start + (double)rendered / opts->fps;
+            render_frame(data);
+            if(capture) {
+                ok = capture_frame(capture, fbo);
+                data->bound.fbo = UNBOUND;
+            }
+            glFlush();
+        }
+        if(!capture_delete(capture)) ok = false;
+        glFinish();
+        fprintf(stderr, "rendered %ld frame%s offscreen at %dx%d\n", rendered, rendered == 1 ? "" : "s", width, height);
+    }
+    perf_fini(&data->perf);
+    
+    if(opts->output) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        save_image(opts->output, width, height);
+    }
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &tex);
+    return ok && all_built(data) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool init_perf(perf_t *perf, const options_t *opts) {
+    if(!opts->stats && !opts->bench && isnan(opts->budget)) return true;
+    // Benchmarks keep every sample of the measured phase, not just a rolling window.
+    if(!perf_init(perf, opts->stats_csv, opts->bench ? 0 : STATS_WINDOW)) return false;
+    perf->report = opts->stats && !opts->bench;
+    return true;
+}
+
+// Dynamic resolution needs GPU frame times, so init_perf() must have enabled the timers.
+static void init_dynres(shades_data_t *data, const options_t *opts) {
+    if(isnan(opts->budget)) return;
+    data->use_dynres = true;
+    dynres_init(&data->dynres, opts->budget, opts->min_res, opts->max_res);
+}
+
+// Sets up the program and texture caches. Either directory is NULL when caching is off or
+// unsupported; both must be freed.
+static void init_cache_dir(const options_t *opts, char **prog_dir, char **tex_dir) {
+    *prog_dir = *tex_dir = NULL;
+    if(opts->no_cache) return;
+    char *dir = opts->cache_dir ? strdup(opts->cache_dir) : progcache_default_dir();
+    if(!dir) return;
+    *tex_dir = texcache_init(dir);
+    if(progcache_init(dir)) {
+        *prog_dir = dir;
+    } else {
+        free(dir);
+    }
+}
+
+static void *glfw_get_proc(const char *name) {
+    return (void *)glfwGetProcAddress(name);
+}
+
+static bool glfw_make_current(void *context, bool current) {
+    glfwMakeContextCurrent(current ? context : NULL);
+    return true;
+}
+
+enum {
+    OPT_HEADLESS = 256,
+    OPT_FPS,
+    OPT_SCALE,
+    OPT_STATS,
+    OPT_STATS_CSV,
+    OPT_BENCH,
+    OPT_WARMUP,
+    OPT_CACHE_DIR,
+    OPT_NO_CACHE,
+    OPT_BUDGET,
+    OPT_MIN_RES,
+    OPT_MAX_RES,
+    OPT_SAMPLER,
+    OPT_COMPRESS,
+    OPT_MAX_FPS,
+    OPT_CAPTURE,
+    OPT_CAPTURE_FORMAT,
+    OPT_CAPTURE_THREADS,
+    OPT_TILE,
+};
+
+static const struct option long_options[] = {
+    {"help",        no_argument,        NULL,   'h'},
+    {"size",        required_argument,  NULL,   's'},
+    {"frames",      required_argument,  NULL,   'n'},
+    {"time",        required_argument,  NULL,   't'},
+    {"output",      required_argument,  NULL,   'o'},
+    {"watch",       no_argument,        NULL,   'w'},
+    {"pass",        required_argument,  NULL,   'p'},
+    {"logical",     no_argument,        NULL,   'l'},
+    {"headless",    no_argument,        NULL,   OPT_HEADLESS},
+    {"fps",         required_argument,  NULL,   OPT_FPS},
+    {"scale",       required_argument,  NULL,   OPT_SCALE},
+    {"stats",       no_argument,        NULL,   OPT_STATS},
+    {"stats-csv",   required_argument,  NULL,   OPT_STATS_CSV},
+    {"bench",       required_argument,  NULL,   OPT_BENCH},
+    {"warmup",      required_argument,  NULL,   OPT_WARMUP},
+    {"cache-dir",   required_argument,  NULL,   OPT_CACHE_DIR},
+    {"no-cache",    no_argument,        NULL,   OPT_NO_CACHE},
+    {"budget",      required_argument,  NULL,   OPT_BUDGET},
+    {"min-res",     required_argument,  NULL,   OPT_MIN_RES},
+    {"max-res",     required_argument,  NULL,   OPT_MAX_RES},
+    {"sampler",     required_argument,  NULL,   OPT_SAMPLER},
+    {"compress",    required_argument,  NULL,   OPT_COMPRESS},
+    {"max-fps",     required_argument,  NULL,   OPT_MAX_FPS},
+    {"capture",     required_argument,  NULL,   OPT_CAPTURE},
+    {"capture-format", required_argument, NULL, OPT_CAPTURE_FORMAT},
+    {"capture-threads", required_argument, NULL, OPT_CAPTURE_THREADS},
+    {"tile",        required_argument,  NULL,   OPT_TILE},
+    {NULL,          0,                  NULL,   0},
+};
+
 int main(int argc, char *args[]) {
     (void)argc;
     (void)args;
@@ -325,8 +1841,19 @@ int main(int argc, char *args[]) {
     if(argc < 2) exit_usage(args[0], "wrong number of arguments");
     
     
-    double width = NAN;
-    double height = NAN;
+    options_t opts = {
+        .width = NAN,
+        .height = NAN,
+        .scale = NAN,
+        .start = 0,
+        .end = NAN,
+        .fps = FPS,
+        .capture_format = CAPTURE_Y4M,
+        .warmup = BENCH_WARMUP,
+        .budget = NAN,
+        .min_res = DYNRES_MIN,
+        .max_res = 1.f,
+    };
     const char *shader_path = NULL;
     const char *tex_path[MAX_TEXTURES] = {NULL};
     
@@ -335,10 +1862,10 @@ int main(int argc, char *args[]) {
     opterr = 0;
     int c = '\0';
     
-    while((c = getopt(argc, args, "s:h")) != -1) {
+    while((c = getopt_long(argc, args, "s:hn:t:o:wp:l", long_options, NULL)) != -1) {
         switch(c) {
             case 's':
-                if(!parse_size(optarg, &width, &height)) {
+                if(!parse_size(optarg, &opts.width, &opts.height)) {
                     exit_usage(args[0], "invalid window size format");
                 }
                 break;
@@ -347,6 +1874,120 @@ int main(int argc, char *args[]) {
                 usage(args[0], stdout, true);
                 exit(EXIT_SUCCESS);
                 break;
+                
+            case 'n':
+                opts.frames = atol(optarg);
+                if(opts.frames <= 0) exit_usage(args[0], "frame count must be positive");
+                break;
+                
+            case 't':
+                if(!parse_range(optarg, &opts.start, &opts.end)) {
+                    exit_usage(args[0], "invalid time range format");
+                }
+                break;
+                
+            case 'o':
+                opts.output = optarg;
+                break;
+                
+            case 'w':
+                opts.watch = true;
+                break;
+                
+            case 'l':
+                opts.logical = true;
+                break;
+                
+            case 'p':
+                if(opts.num_passes >= GRAPH_MAX_PASSES - 1) exit_usage(args[0], "too many passes");
+                opts.passes[opts.num_passes++] = optarg;
+                break;
+                
+            case OPT_HEADLESS:
+                opts.headless = true;
+                break;
+                
+            case OPT_FPS:
+                opts.fps = atof(optarg);
+                if(!(opts.fps > 0)) exit_usage(args[0], "frame rate must be positive");
+                break;
+                
+            case OPT_CAPTURE:
+                opts.capture = optarg;
+                break;
+                
+            case OPT_CAPTURE_FORMAT:
+                if(!capture_parse(optarg, &opts.capture_format)) exit_usage(args[0], "invalid capture format");
+                break;
+                
+            case OPT_CAPTURE_THREADS:
+                opts.capture_threads = atoi(optarg);
+                if(opts.capture_threads <= 0) exit_usage(args[0], "encoder thread count must be positive");
+                break;
+                
+            case OPT_TILE:
+                opts.tile = atoi(optarg);
+                if(opts.tile <= 0) exit_usage(args[0], "tile size must be positive");
+                break;
+                
+            case OPT_MAX_FPS:
+                opts.max_fps = atof(optarg);
+                if(!(opts.max_fps > 0)) exit_usage(args[0], "frame rate must be positive");
+                break;
+                
+            case OPT_SCALE:
+                opts.scale = atof(optarg);
+                if(!(opts.scale >= 1)) exit_usage(args[0], "scale must be at least 1");
+                break;
+                
+            case OPT_STATS:
+                opts.stats = true;
+                break;
+                
+            case OPT_STATS_CSV:
+                opts.stats = true;
+                opts.stats_csv = optarg;
+                break;
+                
+            case OPT_BENCH:
+                opts.bench = atol(optarg);
+                if(opts.bench <= 0) exit_usage(args[0], "benchmark frame count must be positive");
+                break;
+                
+            case OPT_WARMUP:
+                opts.warmup = atol(optarg);
+                if(opts.warmup < 0) exit_usage(args[0], "warmup frame count must not be negative");
+                break;
+                
+            case OPT_CACHE_DIR:
+                opts.cache_dir = optarg;
+                break;
+                
+            case OPT_NO_CACHE:
+                opts.no_cache = true;
+                break;
+                
+            case OPT_BUDGET:
+                opts.budget = atof(optarg);
+                if(!(opts.budget > 0)) exit_usage(args[0], "frame budget must be positive");
+                break;
+                
+            case OPT_MIN_RES:
+                opts.min_res = atof(optarg);
+                if(!(opts.min_res > 0 && opts.min_res <= 1)) exit_usage(args[0], "resolution bounds must be in (0, 1]");
+                break;
+                
+            case OPT_SAMPLER:
+                if(!parse_sampler(optarg, opts.samplers)) exit_usage(args[0], "invalid sampler");
+                break;
+            case OPT_COMPRESS:
+                if(!parse_compress(optarg, opts.compress)) exit_usage(args[0], "invalid compression");
+                break;
+                
+            case OPT_MAX_RES:
+                opts.max_res = atof(optarg);
+                if(!(opts.max_res > 0 && opts.max_res <= 1)) exit_usage(args[0], "resolution bounds must be in (0, 1]");
+                break;
         
             case '?':
                 exit_usage(args[0], "unknown argument");
@@ -356,12 +1997,26 @@ int main(int argc, char *args[]) {
         }
     }
     
-    if(isnan(width) && isnan(height)) {
-        width = WIDTH;
-        height = HEIGHT;
-    } else if(isnan(width)) {
+    if(opts.min_res > opts.max_res) exit_usage(args[0], "minimum resolution is above the maximum");
+    if(opts.capture && (!opts.headless || opts.bench)) {
+        exit_usage(args[0], "--capture only works with --headless renders");
+    }
+    if(opts.capture && opts.stats_csv && !strcmp(opts.capture, "-") && !strcmp(opts.stats_csv, "-")) {
+        exit_usage(args[0], "--capture and --stats-csv can't both write to stdout");
+    }
+    if(opts.tile && (!opts.headless || !opts.output)) {
+        exit_usage(args[0], "--tile only works with --headless renders saved with -o");
+    }
+    if(opts.tile && (opts.num_passes || opts.capture || opts.bench || opts.logical || !isnan(opts.budget))) {
+        exit_usage(args[0], "--tile only renders single-pass shaders, without --capture, --bench, --logical or --budget");
+    }
+    
+    if(isnan(opts.width) && isnan(opts.height)) {
+        opts.width = WIDTH;
+        opts.height = HEIGHT;
+    } else if(isnan(opts.width)) {
         exit_usage(args[0], "height specified without width");
-    } else if(isnan(height)) {
+    } else if(isnan(opts.height)) {
         exit_usage(args[0], "width specified without height");
     }
     
@@ -382,6 +2037,66 @@ int main(int argc, char *args[]) {
         tex_path[i] = args[optind+1+i];
     }
     
+    if(opts.headless) {
+        // Prefer a real surfaceless context. If the platform can't give us one, a hidden GLFW
+        // window still gets us a context, we just won't ever present anything to it.
+        headless_t *ctx = headless_new();
+        GLFWwindow *window = NULL;
+        if(ctx) {
+            if(!gl_init((GLADloadproc) headless_get_proc)) die("could not load OpenGL functions");
+        } else {
+            if(!glfwInit()) die("could not initialise window system");
+            glfwSetErrorCallback(glfw_error);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+            glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+            glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            window = glfwCreateWindow(64, 64, NAME, NULL, NULL);
+            if(!window) die("could not create offscreen context");
+            glfwMakeContextCurrent(window);
+            if(!gl_init((GLADloadproc) glfw_get_proc)) die("could not load OpenGL functions");
+        }
+        CHECK_GL();
+        
+        char *cache_dir, *texcache_dir;
+        init_cache_dir(&opts, &cache_dir, &texcache_dir);
+        shades_data_t data = {
+            .cache_dir = cache_dir,
+            .texcache_dir = texcache_dir,
+            .compiler = compiler_new(NULL, NULL),
+            .sources = source_cache_new(),
+            .building = -1,
+            .logical = opts.logical,
+            .size = VECT2(opts.width, opts.height),
+            .scale = isnan(opts.scale) ? 1.f : opts.scale,
+        };
+        init_graph(&data, &opts, args[0], shader_path, tex_path, num_tex);
+        load_textures(&data, opts.compress);
+        init_samplers(&data, opts.samplers);
+        setup(&data);
+        load_shaders(&data);
+        // Offscreen renders must not depend on how fast images decode.
+        poll_textures(&data, true);
+        if(!init_perf(&data.perf, &opts)) exit(EXIT_FAILURE);
+        init_dynres(&data, &opts);
+        
+        int status = run_headless(&data, &opts);
+        fini_textures(&data);
+        fini_targets(&data);
+        compiler_delete(data.compiler);
+        fini_sources(&data);
+        
+        if(window) {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        }
+        headless_delete(ctx);
+        free(cache_dir);
+        free(texcache_dir);
+        return status;
+    }
+    
     // Create our window
     if(!glfwInit()) die("could not initialise window system");
     glfwSetErrorCallback(glfw_error);
@@ -392,51 +2107,112 @@ int main(int argc, char *args[]) {
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
     
-    GLFWwindow *window = glfwCreateWindow(width, height, NAME, NULL, NULL);
+    GLFWwindow *window = glfwCreateWindow(opts.width, opts.height, NAME, NULL, NULL);
     if(!window) die("could not create application window");
     glfwMakeContextCurrent(window);
     glfwSetWindowSizeLimits(window, 200, 200, GLFW_DONT_CARE, GLFW_DONT_CARE);
 
-    gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
+    if(!gl_init((GLADloadproc) glfw_get_proc)) die("could not load OpenGL functions");
     CHECK_GL();
     
     int w, h;
     glfwGetFramebufferSize(window, &w, &h);
     
+    // Without the parallel compile extension, reloads are built on a worker thread, which needs its
+    // own context in our share group.
+    GLFWwindow *worker = NULL;
+    if(!gl_has_extension("GL_KHR_parallel_shader_compile")) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        worker = glfwCreateWindow(1, 1, NAME, NULL, window);
+        glfwMakeContextCurrent(window);
+    }
+    
+    char *cache_dir, *texcache_dir;
+    init_cache_dir(&opts, &cache_dir, &texcache_dir);
     shades_data_t data = {
-        .shader = {.prog = reload_shader(0, shader_path), .path = shader_path},
+        .cache_dir = cache_dir,
+        .texcache_dir = texcache_dir,
+        .compiler = compiler_new(worker, glfw_make_current),
+        .sources = source_cache_new(),
+        .building = -1,
+        .logical = opts.logical,
         .size = VECT2(w, h),
-        .scale = (float)w/(float)height,
+        .scale = isnan(opts.scale) ? (float)w/(float)opts.height : opts.scale,
     };
     
-    
-    for(int i = 0; i < num_tex && i < MAX_TEXTURES; ++i) {
-        const char *path = tex_path[i];
-        data.textures[i].path = path;
-        glActiveTexture(GL_TEXTURE0+i);
-        data.textures[i].tex = reload_texture(0, path, &data.textures[i].size);
-    }
+    init_graph(&data, &opts, args[0], shader_path, tex_path, num_tex);
+    load_textures(&data, opts.compress);
+    init_samplers(&data, opts.samplers);
     
     setup(&data);
-    fetch_shader_info(&data);
+    load_shaders(&data);
+    if(!init_perf(&data.perf, &opts)) exit(EXIT_FAILURE);
+    init_dynres(&data, &opts);
+    if(opts.watch) init_watch(&data);
     glfwSetWindowUserPointer(window, &data);
     // glfwSetWindowSizeCallback(window, resize_callback);
     glfwSetKeyCallback(window, key_callback);
     glfwSetFramebufferSizeCallback(window, framebuffer_callback);
+    glfwSetWindowRefreshCallback(window, refresh_callback);
+    glfwSetWindowIconifyCallback(window, iconify_callback);
     
     
-    // Main Loop
+    if(opts.bench) {
+        glfwSwapInterval(0);
+        poll_textures(&data, true);
+        run_bench(&data, &opts, window);
+        perf_fini(&data.perf);
+        fini_textures(&data);
+        fini_targets(&data);
+        compiler_delete(data.compiler);
+        fini_sources(&data);
+        if(worker) glfwDestroyWindow(worker);
+        glfwDestroyWindow(window);
+        free(cache_dir);
+        free(texcache_dir);
+        return all_built(&data) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    
+    // Main Loop. Static shaders only render when something changed, and nothing renders while the
+    // window can't be seen: otherwise we just wait for events.
+    double deadline = glfwGetTime();
     while(!glfwWindowShouldClose(window)) {
-        glClearColor(0.0, 0.0, 0.0, 1.0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        // glViewport(0, 0, WIDTH*SCALE, HEIGHT*SCALE);
+        if(opts.frames && data.frame >= opts.frames) break;
+        
+        bool hidden = glfwGetWindowAttrib(window, GLFW_ICONIFIED) || !glfwGetWindowAttrib(window, GLFW_VISIBLE);
+        if(hidden || !needs_frame(&data)) {
+            poll_builds(&data, false);
+            poll_textures(&data, false);
+        }
+        if(hidden || !needs_frame(&data)) {
+            wait_idle(&data);
+            poll_watch(&data);
+            deadline = glfwGetTime();
+            continue;
+        }
         
-        run_loop(&data);
+        data.time = glfwGetTime();
+        render_frame(&data);
+        data.redraw = false;
         
         glfwSwapBuffers(window);
-        glfwPollEvents();
+        if(opts.max_fps > 0) {
+            pace_frame(&deadline, 1.0 / opts.max_fps);
+        } else {
+            glfwPollEvents();
+        }
+        poll_watch(&data);
     }
     
     // end window loop
+    watch_delete(data.watch);
+    perf_fini(&data.perf);
+    fini_textures(&data);
+    fini_targets(&data);
+    compiler_delete(data.compiler);
+    fini_sources(&data);
+    if(worker) glfwDestroyWindow(worker);
     glfwDestroyWindow(window);
+    free(cache_dir);
+    free(texcache_dir);
 }
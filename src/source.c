@@ -0,0 +1,299 @@
+//===--------------------------------------------------------------------------------------------===
+// source.c - Memory-mapped shader sources with #include support
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "source.h"
+#include "hash.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+// A run of a file's text, followed by the file it includes, if any.
+typedef struct {
+    size_t          start;
+    size_t          length;
+    char            *include;   // path as written, relative to the including file
+    int             line;       // line the file resumes at after the include
+} segment_t;
+
+typedef struct {
+    char            *path;      // canonical
+    struct timespec mtime;
+    off_t           size;
+    ino_t           inode;
+
+    const char      *data;
+    size_t          length;
+    void            *mapping;
+    uint64_t        hash;
+
+    segment_t       *segments;
+    int             count;
+    unsigned        visit;      // last load that emitted the file
+} file_t;
+
+// `#line` directives are the only text we make up. They live in blocks that don't move, so pieces
+// can point into them while more are added.
+typedef struct block_t {
+    struct block_t  *next;
+    size_t          used;
+    char            data[4096];
+} block_t;
+
+struct source_cache_t {
+    file_t          **files;
+    int             count;
+    int             capacity;
+    unsigned        visit;
+    block_t         *blocks;
+};
+
+source_cache_t *source_cache_new(void) {
+    return calloc(1, sizeof(source_cache_t));
+}
+
+static void free_segments(file_t *file) {
+    for(int i = 0; i < file->count; ++i) free(file->segments[i].include);
+    free(file->segments);
+    file->segments = NULL;
+    file->count = 0;
+}
+
+static void unmap(file_t *file) {
+    if(file->mapping) munmap(file->mapping, file->length);
+    file->mapping = NULL;
+    file->data = NULL;
+    file->length = 0;
+}
+
+static void free_blocks(source_cache_t *cache) {
+    while(cache->blocks) {
+        block_t *next = cache->blocks->next;
+        free(cache->blocks);
+        cache->blocks = next;
+    }
+}
+
+void source_cache_delete(source_cache_t *cache) {
+    if(!cache) return;
+    for(int i = 0; i < cache->count; ++i) {
+        file_t *file = cache->files[i];
+        unmap(file);
+        free_segments(file);
+        free(file->path);
+        free(file);
+    }
+    free(cache->files);
+    free_blocks(cache);
+    free(cache);
+}
+
+// Matches `#include "name"` (or <name>), with any amount of blank space between the tokens.
+static bool parse_include(const char *line, size_t length, const char **name, size_t *name_length) {
+    const char *p = line, *end = line + length;
+    while(p < end && (*p == ' ' || *p == '\t')) ++p;
+    if(p == end || *p++ != '#') return false;
+    while(p < end && (*p == ' ' || *p == '\t')) ++p;
+    if(end - p < 7 || memcmp(p, "include", 7)) return false;
+    p += 7;
+    while(p < end && (*p == ' ' || *p == '\t')) ++p;
+    if(p == end || (*p != '"' && *p != '<')) return false;
+
+    char close = *p++ == '"' ? '"' : '>';
+    const char *stop = memchr(p, close, end - p);
+    if(!stop || stop == p) return false;
+    *name = p;
+    *name_length = stop - p;
+    return true;
+}
+
+static void parse(file_t *file) {
+    free_segments(file);
+    int capacity = 4;
+    file->segments = malloc(capacity * sizeof(segment_t));
+
+    size_t run = 0;
+    int line = 1;
+    for(size_t at = 0; at < file->length; ++line) {
+        const char *newline = memchr(file->data + at, '\n', file->length - at);
+        size_t end = newline ? (size_t)(newline - file->data) : file->length;
+
+        const char *name = NULL;
+        size_t name_length = 0;
+        if(parse_include(file->data + at, end - at, &name, &name_length)) {
+            if(file->count + 1 == capacity) {
+                capacity *= 2;
+                file->segments = realloc(file->segments, capacity * sizeof(segment_t));
+            }
+            segment_t *segment = &file->segments[file->count++];
+            segment->start = run;
+            segment->length = at - run;
+            segment->include = strndup(name, name_length);
+            segment->line = line + 1;
+            run = newline ? end + 1 : end;
+        }
+        at = end + 1;
+    }
+    file->segments[file->count++] = (segment_t){.start = run, .length = file->length - run};
+}
+
+// Maps the file again if it changed on disk since we last looked, and parses it again if its
+// contents are actually different.
+static bool refresh(file_t *file) {
+    struct stat st;
+    if(stat(file->path, &st)) return false;
+    if(file->segments && st.st_size == file->size && st.st_ino == file->inode
+       && st.st_mtim.tv_sec == file->mtime.tv_sec && st.st_mtim.tv_nsec == file->mtime.tv_nsec) {
+        return true;
+    }
+
+    int fd = open(file->path, O_RDONLY);
+    if(fd < 0) return false;
+    void *mapping = NULL;
+    if(st.st_size > 0) {
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+
+    unmap(file);
+    file->mapping = mapping;
+    file->data = mapping ? mapping : "";
+    file->length = st.st_size;
+    file->size = st.st_size;
+    file->inode = st.st_ino;
+    file->mtime = st.st_mtim;
+
+    // Segments are offsets into the text, so they still hold when only the timestamp changed.
+    uint64_t hash = hash_words(HASH_INIT, file->data, file->length);
+    if(!file->segments || hash != file->hash) parse(file);
+    file->hash = hash;
+    return true;
+}
+
+static file_t *open_file(source_cache_t *cache, const char *path) {
+    char canonical[PATH_MAX];
+    if(!realpath(path, canonical)) return NULL;
+
+    file_t *file = NULL;
+    for(int i = 0; i < cache->count && !file; ++i) {
+        if(!strcmp(cache->files[i]->path, canonical)) file = cache->files[i];
+    }
+    if(!file) {
+        if(cache->count == cache->capacity) {
+            cache->capacity = cache->capacity ? cache->capacity * 2 : 8;
+            cache->files = realloc(cache->files, cache->capacity * sizeof(file_t *));
+        }
+        file = calloc(1, sizeof(file_t));
+        file->path = strdup(canonical);
+        cache->files[cache->count++] = file;
+    }
+    // Files already emitted during this load are left alone: pieces point into their mapping.
+    if(file->visit == cache->visit) return file;
+    return refresh(file) ? file : NULL;
+}
+
+static void add_piece(source_t *source, int *capacity, const char *string, size_t length) {
+    if(source->count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        source->strings = realloc(source->strings, *capacity * sizeof(const char *));
+        source->lengths = realloc(source->lengths, *capacity * sizeof(GLint));
+    }
+    source->strings[source->count] = string;
+    source->lengths[source->count] = (GLint)length;
+    source->count += 1;
+}
+
+static void add_line(source_cache_t *cache, source_t *source, int *capacity, int line, int number) {
+    char text[40];
+    int length = snprintf(text, sizeof(text), "#line %d %d\n", line, number);
+
+    block_t *block = cache->blocks;
+    if(!block || block->used + length > sizeof(block->data)) {
+        block = calloc(1, sizeof(block_t));
+        block->next = cache->blocks;
+        cache->blocks = block;
+    }
+    char *copy = block->data + block->used;
+    memcpy(copy, text, length);
+    block->used += length;
+    add_piece(source, capacity, copy, length);
+}
+
+static bool emit(source_cache_t *cache, file_t *file, source_t *source, int *capacity) {
+    if(file->visit == cache->visit) return true;
+    file->visit = cache->visit;
+
+    int number = source->file_count++;
+    source->files = realloc(source->files, source->file_count * sizeof(const char *));
+    source->files[number] = file->path;
+    source->hash = hash_bytes(source->hash, &file->hash, sizeof(file->hash));
+    add_line(cache, source, capacity, 1, number);
+
+    for(int i = 0; i < file->count; ++i) {
+        const segment_t *segment = &file->segments[i];
+        if(segment->length) add_piece(source, capacity, file->data + segment->start, segment->length);
+        if(!segment->include) continue;
+
+        // Relative includes are looked up next to the including file.
+        const char *slash = strrchr(file->path, '/');
+        int dir = segment->include[0] == '/' || !slash ? 0 : (int)(slash - file->path + 1);
+        char path[dir + strlen(segment->include) + 1];
+        memcpy(path, file->path, dir);
+        strcpy(path + dir, segment->include);
+
+        file_t *included = open_file(cache, path);
+        if(!included) {
+            fprintf(stderr, "could not open `%s`, included from `%s`\n", segment->include, file->path);
+            return false;
+        }
+        if(!emit(cache, included, source, capacity)) return false;
+        add_line(cache, source, capacity, segment->line, number);
+    }
+    return true;
+}
+
+bool source_load(source_cache_t *cache, const char *path, source_t *source) {
+    assert(cache);
+    assert(path);
+    assert(source);
+
+    *source = (source_t){.hash = HASH_INIT};
+    free_blocks(cache);
+    cache->visit += 1;
+
+    file_t *file = open_file(cache, path);
+    if(!file) return false;
+
+    int capacity = 0;
+    if(!emit(cache, file, source, &capacity)) {
+        source_free(source);
+        return false;
+    }
+    return true;
+}
+
+void source_free(source_t *source) {
+    if(!source) return;
+    free(source->strings);
+    free(source->lengths);
+    free(source->files);
+    *source = (source_t){0};
+}
@@ -0,0 +1,46 @@
+//===--------------------------------------------------------------------------------------------===
+// source.h - Memory-mapped shader sources with #include support
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include "gl.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct source_cache_t source_cache_t;
+
+// A shader source with its includes resolved, as pieces ready for glShaderSource(). The pieces point
+// into the cache's mapped files, and are only valid until the next source_load() on that cache.
+typedef struct {
+    const char      **strings;
+    GLint           *lengths;
+    int             count;
+
+    const char      **files;    // every file that went in, the main one first
+    int             file_count;
+    uint64_t        hash;       // of those files' contents
+} source_t;
+
+source_cache_t *source_cache_new(void);
+void source_cache_delete(source_cache_t *cache);
+
+// Loads the shader at `path`, replacing each `#include "file"` line with that file's contents.
+// Included paths are relative to the including file, and each file is included at most once, so
+// libraries don't need guards. `#line` directives keep compiler errors pointing at the right line:
+// the source string number is the file's index in `files`.
+//
+// Files are mapped rather than read, and kept mapped between loads. A file is only mapped again when
+// its modification time or size changed, and only parsed again when its contents did.
+bool source_load(source_cache_t *cache, const char *path, source_t *source);
+void source_free(source_t *source);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
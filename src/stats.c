@@ -0,0 +1,91 @@
+//===--------------------------------------------------------------------------------------------===
+// stats.c - Rolling frame time statistics
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "stats.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define GROWABLE_DEFAULT 1024
+
+void stats_init(stats_t *stats, size_t window) {
+    assert(stats);
+    stats->growable = window == 0;
+    stats->capacity = window ? window : GROWABLE_DEFAULT;
+    stats->samples = calloc(stats->capacity, sizeof(double));
+    stats->count = 0;
+    stats->next = 0;
+}
+
+void stats_fini(stats_t *stats) {
+    assert(stats);
+    free(stats->samples);
+    stats->samples = NULL;
+    stats->capacity = stats->count = stats->next = 0;
+}
+
+void stats_reset(stats_t *stats) {
+    assert(stats);
+    stats->count = 0;
+    stats->next = 0;
+}
+
+void stats_push(stats_t *stats, double sample) {
+    assert(stats);
+    if(isnan(sample)) return;
+    
+    if(stats->growable) {
+        if(stats->count == stats->capacity) {
+            stats->capacity *= 2;
+            stats->samples = realloc(stats->samples, stats->capacity * sizeof(double));
+        }
+        stats->samples[stats->count++] = sample;
+        return;
+    }
+    
+    stats->samples[stats->next] = sample;
+    stats->next = (stats->next + 1) % stats->capacity;
+    if(stats->count < stats->capacity) stats->count += 1;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile on sorted data.
+static double percentile(const double *sorted, size_t count, double p) {
+    size_t rank = (size_t)ceil(p * (double)count);
+    if(rank < 1) rank = 1;
+    if(rank > count) rank = count;
+    return sorted[rank-1];
+}
+
+stats_summary_t stats_summary(const stats_t *stats) {
+    assert(stats);
+    stats_summary_t summary = {.min = NAN, .avg = NAN, .p50 = NAN, .p99 = NAN, .max = NAN};
+    if(!stats->count) return summary;
+    
+    double *sorted = malloc(stats->count * sizeof(double));
+    memcpy(sorted, stats->samples, stats->count * sizeof(double));
+    qsort(sorted, stats->count, sizeof(double), compare_double);
+    
+    double total = 0;
+    for(size_t i = 0; i < stats->count; ++i) total += sorted[i];
+    
+    summary.count = stats->count;
+    summary.min = sorted[0];
+    summary.max = sorted[stats->count-1];
+    summary.avg = total / (double)stats->count;
+    summary.p50 = percentile(sorted, stats->count, 0.50);
+    summary.p99 = percentile(sorted, stats->count, 0.99);
+    free(sorted);
+    return summary;
+}
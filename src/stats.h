@@ -0,0 +1,44 @@
+//===--------------------------------------------------------------------------------------------===
+// stats.h - Rolling frame time statistics
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    double      *samples;
+    size_t      capacity;
+    size_t      count;
+    size_t      next;
+    bool        growable;
+} stats_t;
+
+typedef struct {
+    size_t      count;
+    double      min;
+    double      avg;
+    double      p50;
+    double      p99;
+    double      max;
+} stats_summary_t;
+
+// Keeps the last `window` samples. A window of 0 keeps every sample pushed.
+void stats_init(stats_t *stats, size_t window);
+void stats_fini(stats_t *stats);
+void stats_reset(stats_t *stats);
+
+void stats_push(stats_t *stats, double sample);
+stats_summary_t stats_summary(const stats_t *stats);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
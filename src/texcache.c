@@ -0,0 +1,203 @@
+//===--------------------------------------------------------------------------------------------===
+// texcache.c - On-disk cache of decoded, mipmapped texel data
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "texcache.h"
+#include "hash.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+#define CACHE_MAGIC     0x58544853u // 'SHTX'
+#define CACHE_VERSION   1
+// Texel data starts at a fixed offset, so that levels keep the alignment of their texel type.
+#define CACHE_DATA      64
+
+typedef struct {
+    uint32_t    magic;
+    uint32_t    version;
+    uint64_t    key;
+    uint64_t    data_size;
+    int32_t     width;
+    int32_t     height;
+    int32_t     components;
+    int32_t     levels;
+    uint32_t    type;
+    uint32_t    internal;
+} cache_header_t;
+
+_Static_assert(sizeof(cache_header_t) <= CACHE_DATA, "texture cache header too large");
+
+char *texcache_init(const char *base) {
+    assert(base);
+    size_t len = strlen(base) + sizeof("/textures");
+    char *dir = calloc(len, sizeof(char));
+    snprintf(dir, len, "%s/textures", base);
+    if(!make_dirs(dir)) {
+        fprintf(stderr, "texture cache disabled: could not create `%s`\n", dir);
+        free(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+bool texcache_key(const char *path, uint64_t *key) {
+    assert(path);
+    assert(key);
+    
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return false;
+    
+    struct stat st;
+    if(fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    
+    uint64_t hash = hash_str(HASH_INIT, path);
+    int64_t stamp[3] = {st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+    hash = hash_bytes(hash, stamp, sizeof(stamp));
+    
+    // The modification time alone would miss a file replaced by one with the same size and
+    // timestamp, which some tools (cp -p, rsync, archive extraction) do.
+    if(st.st_size > 0) {
+        void *contents = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(contents == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        hash = hash_bytes(hash, contents, st.st_size);
+        munmap(contents, st.st_size);
+    }
+    close(fd);
+    *key = hash;
+    return true;
+}
+
+static void cache_path(char *out, size_t size, const char *dir, uint64_t key) {
+    snprintf(out, size, "%s/%016" PRIx64 ".tex", dir, key);
+}
+
+static bool valid_header(const cache_header_t *header, uint64_t key, size_t file_size) {
+    if(header->magic != CACHE_MAGIC || header->version != CACHE_VERSION || header->key != key) return false;
+    if(header->width < 1 || header->height < 1 || header->components < 1 || header->components > 4) return false;
+    if(header->levels < 1 || header->levels > gl_mip_levels(header->width, header->height)) return false;
+    if(header->type != GL_UNSIGNED_BYTE && header->type != GL_UNSIGNED_SHORT && header->type != GL_FLOAT) return false;
+    
+    gl_image_t shape = {
+        .width = header->width,
+        .height = header->height,
+        .components = header->components,
+        .type = header->type,
+        .internal = header->internal,
+    };
+    return header->data_size == gl_image_size(&shape, header->levels)
+        && file_size == CACHE_DATA + header->data_size;
+}
+
+bool texcache_load(const char *dir, uint64_t key, gl_image_t *image) {
+    assert(dir);
+    assert(image);
+    char path[strlen(dir) + 32];
+    cache_path(path, sizeof(path), dir, key);
+    
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return false;
+    
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size < CACHE_DATA) {
+        close(fd);
+        return false;
+    }
+    
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) return false;
+    
+    const cache_header_t *header = mapping;
+    if(!valid_header(header, key, st.st_size)) {
+        fprintf(stderr, "texture cache: discarding invalid entry `%s`\n", path);
+        munmap(mapping, st.st_size);
+        remove(path);
+        return false;
+    }
+    // Every byte is about to be streamed to the GPU, front to back.
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+    
+    *image = (gl_image_t){
+        .pixels = (uint8_t *)mapping + CACHE_DATA,
+        .width = header->width,
+        .height = header->height,
+        .components = header->components,
+        .type = header->type,
+        .internal = header->internal,
+        .levels = header->levels,
+        .mapping = mapping,
+        .mapping_size = st.st_size,
+    };
+    return true;
+}
+
+void texcache_store(const char *dir, uint64_t key, const gl_image_t *image) {
+    assert(dir);
+    assert(image && image->pixels);
+    
+    char path[strlen(dir) + 32];
+    cache_path(path, sizeof(path), dir, key);
+    
+    // Write to a temporary file and rename it in place, so that a second instance never maps a
+    // half-written image. The name is unique, as the same image may be stored by two workers.
+    char tmp[sizeof(path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if(fd < 0) {
+        fprintf(stderr, "texture cache: could not write `%s`\n", path);
+        return;
+    }
+    fchmod(fd, 0644);
+    FILE *f = fdopen(fd, "wb");
+    if(!f) {
+        fprintf(stderr, "texture cache: could not write `%s`\n", path);
+        close(fd);
+        remove(tmp);
+        return;
+    }
+    
+    uint8_t header[CACHE_DATA] = {0};
+    cache_header_t fields = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .key = key,
+        .data_size = gl_image_size(image, image->levels),
+        .width = image->width,
+        .height = image->height,
+        .components = image->components,
+        .levels = image->levels,
+        .type = image->type,
+        .internal = image->internal,
+    };
+    memcpy(header, &fields, sizeof(fields));
+    
+    bool ok = fwrite(header, sizeof(header), 1, f) == 1
+           && fwrite(image->pixels, 1, fields.data_size, f) == fields.data_size;
+    ok = !fclose(f) && ok;
+    
+    if(!ok || rename(tmp, path)) {
+        fprintf(stderr, "texture cache: could not write `%s`\n", path);
+        remove(tmp);
+    }
+}
@@ -0,0 +1,34 @@
+//===--------------------------------------------------------------------------------------------===
+// texcache.h - On-disk cache of decoded, mipmapped texel data
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include "gl.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Creates the texture cache under the `base` cache directory. Returns its path (heap-allocated), or
+// NULL if it could not be created.
+char *texcache_init(const char *base);
+
+// Key for the image file at `path`: its path, size, modification time and contents. Returns false if
+// the file can't be read.
+bool texcache_key(const char *path, uint64_t *key);
+
+// Maps a cached image into memory. The pixels are used in place, so `image` must be freed with
+// gl_free_image() like a decoded one. Returns false on a miss.
+bool texcache_load(const char *dir, uint64_t key, gl_image_t *image);
+
+// Saves a decoded image and all of its levels. Safe to call from any thread.
+void texcache_store(const char *dir, uint64_t key, const gl_image_t *image);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
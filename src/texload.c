@@ -0,0 +1,216 @@
+//===--------------------------------------------------------------------------------------------===
+// texload.c - Background texture decoding
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "texload.h"
+#include "bcenc.h"
+#include "hash.h"
+#include "texcache.h"
+#include "timer.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Rows of blocks per compression task. Big levels are split into many tasks, so that a single image
+// is compressed on every worker.
+#define ENCODE_ROWS 16
+
+typedef struct encode_t encode_t;
+
+typedef struct job_t {
+    struct job_t        *next;
+    texload_t           *loader;
+    char                *path;
+    GLenum              compress;
+    bool                keyed;
+    uint64_t            key;
+    double              start;
+    
+    gl_image_t          source;     // uncompressed image, while it's being compressed
+    encode_t            *tasks;
+    int                 remaining;  // compression tasks not done yet, under the loader's lock
+    texload_result_t    result;
+} job_t;
+
+struct encode_t {
+    job_t               *job;
+    int                 level;
+    int                 first;
+    int                 count;
+};
+
+struct texload_t {
+    pool_t              *pool;
+    char                *cache_dir;
+    
+    pthread_mutex_t     lock;
+    pthread_cond_t      done;
+    job_t               *finished;
+    job_t               *last;
+    int                 pending;
+};
+
+// Saves a newly decoded image to the cache, and hands it over to texload_poll().
+static void finish_job(job_t *job) {
+    texload_t *loader = job->loader;
+    texload_result_t *result = &job->result;
+    if(result->ok) {
+        // The other levels are derived from the first, so it's enough to tell images apart.
+        result->hash = hash_words(HASH_INIT, result->image.pixels, gl_image_size(&result->image, 1));
+        result->hash = hash_bytes(result->hash, &result->image.internal, sizeof(result->image.internal));
+    }
+    result->decode_ms = (timer_now() - job->start) * 1e3;
+    if(result->ok && !result->cached && job->keyed) texcache_store(loader->cache_dir, job->key, &result->image);
+    
+    pthread_mutex_lock(&loader->lock);
+    if(loader->last) loader->last->next = job;
+    else loader->finished = job;
+    loader->last = job;
+    pthread_cond_broadcast(&loader->done);
+    pthread_mutex_unlock(&loader->lock);
+}
+
+static void encode_job(void *arg) {
+    encode_t *task = arg;
+    job_t *job = task->job;
+    bcenc_encode(&job->source, &job->result.image, task->level, task->first, task->count);
+    
+    pthread_mutex_lock(&job->loader->lock);
+    bool last = --job->remaining == 0;
+    pthread_mutex_unlock(&job->loader->lock);
+    if(!last) return;
+    
+    gl_free_image(&job->source);
+    free(job->tasks);
+    job->tasks = NULL;
+    finish_job(job);
+}
+
+// Swaps the decoded image for its compressed version, and queues up its compression in bands of
+// rows. Returns false if the image is kept as is.
+static bool start_encode(job_t *job) {
+    texload_t *loader = job->loader;
+    if(!bcenc_can_encode(&job->result.image)) {
+        fprintf(stderr, "cannot compress `%s` to %s, keeping it uncompressed\n",
+                job->path, bcenc_name(job->compress));
+        return false;
+    }
+    job->source = job->result.image;
+    if(!bcenc_alloc(&job->source, job->compress, &job->result.image)) {
+        job->result.image = job->source;
+        return false;
+    }
+    
+    int count = 0;
+    for(int level = 0; level < job->source.levels; ++level) {
+        count += (bcenc_rows(&job->source, level) + ENCODE_ROWS - 1) / ENCODE_ROWS;
+    }
+    job->tasks = calloc(count, sizeof(encode_t));
+    job->remaining = count;
+    
+    encode_t *task = job->tasks;
+    for(int level = 0; level < job->source.levels; ++level) {
+        int rows = bcenc_rows(&job->source, level);
+        for(int first = 0; first < rows; first += ENCODE_ROWS, ++task) {
+            *task = (encode_t){job, level, first, rows - first < ENCODE_ROWS ? rows - first : ENCODE_ROWS};
+        }
+    }
+    for(int i = 0; i < count; ++i) pool_submit(loader->pool, encode_job, &job->tasks[i]);
+    return true;
+}
+
+static void decode_job(void *arg) {
+    job_t *job = arg;
+    texload_t *loader = job->loader;
+    texload_result_t *result = &job->result;
+    
+    job->start = timer_now();
+    job->keyed = loader->cache_dir && texcache_key(job->path, &job->key);
+    if(job->keyed && job->compress) job->key = hash_bytes(job->key, &job->compress, sizeof(job->compress));
+    
+    if(job->keyed && texcache_load(loader->cache_dir, job->key, &result->image)) {
+        result->ok = result->cached = true;
+        finish_job(job);
+        return;
+    }
+    
+    // Mipmaps are built here rather than on the GPU, so that the cache holds the whole chain.
+    result->ok = gl_decode_image(job->path, &result->image);
+    bool mips = result->ok && gl_build_mips(&result->image);
+    if(mips && job->compress && start_encode(job)) return;
+    finish_job(job);
+}
+
+texload_t *texload_new(pool_t *pool, const char *cache_dir) {
+    assert(pool);
+    texload_t *loader = calloc(1, sizeof(texload_t));
+    loader->pool = pool;
+    loader->cache_dir = cache_dir ? strdup(cache_dir) : NULL;
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->done, NULL);
+    return loader;
+}
+
+void texload_delete(texload_t *loader) {
+    if(!loader) return;
+    
+    texload_result_t result;
+    while(texload_poll(loader, &result, true)) {
+        if(result.ok) gl_free_image(&result.image);
+    }
+    pthread_cond_destroy(&loader->done);
+    pthread_mutex_destroy(&loader->lock);
+    free(loader->cache_dir);
+    free(loader);
+}
+
+void texload_start(texload_t *loader, int id, unsigned generation, const char *path, GLenum compress) {
+    assert(loader);
+    assert(path);
+    
+    job_t *job = calloc(1, sizeof(job_t));
+    job->loader = loader;
+    job->path = strdup(path);
+    job->compress = compress;
+    job->result.id = id;
+    job->result.generation = generation;
+    
+    pthread_mutex_lock(&loader->lock);
+    loader->pending += 1;
+    pthread_mutex_unlock(&loader->lock);
+    pool_submit(loader->pool, decode_job, job);
+}
+
+int texload_pending(const texload_t *loader) {
+    assert(loader);
+    return loader->pending;
+}
+
+bool texload_poll(texload_t *loader, texload_result_t *result, bool wait) {
+    assert(loader);
+    assert(result);
+    
+    pthread_mutex_lock(&loader->lock);
+    while(wait && !loader->finished && loader->pending) {
+        pthread_cond_wait(&loader->done, &loader->lock);
+    }
+    job_t *job = loader->finished;
+    if(job) {
+        loader->finished = job->next;
+        if(!loader->finished) loader->last = NULL;
+        loader->pending -= 1;
+    }
+    pthread_mutex_unlock(&loader->lock);
+    
+    if(!job) return false;
+    *result = job->result;
+    free(job->path);
+    free(job);
+    return true;
+}
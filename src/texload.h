@@ -0,0 +1,51 @@
+//===--------------------------------------------------------------------------------------------===
+// texload.h - Background texture decoding
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include "gl.h"
+#include "pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct texload_t texload_t;
+
+typedef struct {
+    int             id;         // caller's tag, passed to texload_start()
+    unsigned        generation;
+    bool            ok;
+    bool            cached;     // mapped from the texture cache rather than decoded
+    gl_image_t      image;      // owned by the caller once returned, free with gl_free_image()
+    uint64_t        hash;       // of the image's texels, to tell whether a reload changed anything
+    double          decode_ms;
+} texload_result_t;
+
+// Decodes images on `pool`. The pool must outlive the loader. With a `cache_dir` (see
+// texcache_init()), images are mapped from the texture cache when possible, and saved to it after
+// they are decoded.
+texload_t *texload_new(pool_t *pool, const char *cache_dir);
+
+// Waits for decodes still running, and drops results that were never picked up.
+void texload_delete(texload_t *loader);
+
+// Starts decoding `path` in the background. `id` and `generation` come back with the result, so
+// callers can tell which texture it's for, and whether a newer load was started since. With a
+// `compress` format (see bcenc_parse()), the image and its mipmaps are block-compressed too.
+void texload_start(texload_t *loader, int id, unsigned generation, const char *path, GLenum compress);
+
+// Number of decodes started whose results haven't been returned by texload_poll() yet.
+int texload_pending(const texload_t *loader);
+
+// Returns a finished decode, in completion order. With `wait`, blocks until one finishes, unless
+// nothing is pending.
+bool texload_poll(texload_t *loader, texload_result_t *result, bool wait);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,239 @@
+//===--------------------------------------------------------------------------------------------===
+// tiler.c - Tiled rendering of images larger than a render target
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "tiler.h"
+#include "pngenc.h"
+#include "timer.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tiles in flight. Tile N is copied out when tile N + TILER_RING is queued, so its readback
+// overlaps rendering the two tiles after it.
+#define TILER_RING 3
+
+typedef struct {
+    tile_t          tile;
+    GLsync          fence;
+} slot_t;
+
+struct tiler_t {
+    char            *path;
+    FILE            *ppm;
+    png_stream_t    *png;
+    int             width;
+    int             height;
+    int             tile_size;
+    
+    tile_t          next;       // next tile to hand out
+    tile_t          current;    // last tile handed out
+    
+    GLuint          pbo;
+    uint8_t         *mapped;    // persistent mapping, or NULL
+    size_t          slot_size;
+    slot_t          slots[TILER_RING];
+    long            queued;
+    long            drained;
+    long            total;
+    
+    // The row of tiles being put together, top row first, and a PPM row's worth of RGB.
+    uint8_t         *band;
+    uint8_t         *row;
+    
+    bool            failed;
+    double          start;
+    double          wait_ms;
+    double          write_ms;
+};
+
+static bool ends_with(const char *string, const char *suffix) {
+    size_t length = strlen(string), suffix_length = strlen(suffix);
+    return length >= suffix_length && !strcmp(string + length - suffix_length, suffix);
+}
+
+static int min_int(int a, int b) {
+    return a < b ? a : b;
+}
+
+tiler_t *tiler_new(const char *path, int width, int height, int tile_size) {
+    assert(path);
+    assert(width > 0 && height > 0);
+    assert(tile_size > 0);
+    
+    tiler_t *tiler = calloc(1, sizeof(tiler_t));
+    if(ends_with(path, ".png") || ends_with(path, ".PNG")) {
+        tiler->png = png_stream_new(path, width, height);
+        if(!tiler->png) {
+            free(tiler);
+            return NULL;
+        }
+    } else {
+        tiler->ppm = fopen(path, "wb");
+        if(!tiler->ppm) {
+            fprintf(stderr, "could not open `%s` for writing\n", path);
+            free(tiler);
+            return NULL;
+        }
+        fprintf(tiler->ppm, "P6\n%d %d\n255\n", width, height);
+        tiler->row = malloc((size_t)width * 3);
+    }
+    
+    tiler->path = strdup(path);
+    tiler->width = width;
+    tiler->height = height;
+    tiler->tile_size = tile_size;
+    tiler->next = (tile_t){0, 0, min_int(tile_size, width), min_int(tile_size, height)};
+    
+    long columns = (width + tile_size - 1) / tile_size;
+    long rows = (height + tile_size - 1) / tile_size;
+    tiler->total = columns * rows;
+    tiler->band = malloc((size_t)width * tiler->next.height * 4);
+    
+    // The first tile is as large as they get.
+    tiler->slot_size = (size_t)tiler->next.width * tiler->next.height * 4;
+    void *mapped = NULL;
+    tiler->pbo = gl_create_stream_buffer(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)(TILER_RING * tiler->slot_size),
+                                         GL_MAP_READ_BIT, &mapped);
+    tiler->mapped = mapped;
+    
+    fprintf(stderr, "rendering %dx%d in %ld tile%s of up to %dx%d\n", width, height,
+            tiler->total, tiler->total == 1 ? "" : "s", tiler->next.width, tiler->next.height);
+    tiler->start = timer_now();
+    return tiler;
+}
+
+bool tiler_next(tiler_t *tiler, tile_t *tile) {
+    assert(tiler);
+    assert(tile);
+    
+    if(tiler->next.y >= tiler->height) return false;
+    *tile = tiler->current = tiler->next;
+    
+    tile_t *next = &tiler->next;
+    next->x += tiler->tile_size;
+    if(next->x >= tiler->width) {
+        next->x = 0;
+        next->y += tiler->tile_size;
+    }
+    next->width = min_int(tiler->tile_size, tiler->width - next->x);
+    next->height = min_int(tiler->tile_size, tiler->height - next->y);
+    return true;
+}
+
+static void write_failed(tiler_t *tiler) {
+    if(!tiler->failed) fprintf(stderr, "could not write to `%s`\n", tiler->path);
+    tiler->failed = true;
+}
+
+// Writes out the first `rows` rows of the band, once its last tile is in.
+static void write_band(tiler_t *tiler, int rows) {
+    if(tiler->failed) return;
+    
+    size_t pitch = (size_t)tiler->width * 4;
+    if(tiler->png) {
+        if(!png_stream_rows(tiler->png, tiler->band, pitch, rows)) tiler->failed = true;
+        return;
+    }
+    for(int y = 0; y < rows; ++y) {
+        const uint8_t *src = tiler->band + y * pitch;
+        for(int x = 0; x < tiler->width; ++x) memcpy(tiler->row + x * 3, src + x * 4, 3);
+        if(fwrite(tiler->row, 3, tiler->width, tiler->ppm) != (size_t)tiler->width) {
+            write_failed(tiler);
+            return;
+        }
+    }
+}
+
+// Copies the oldest tile in flight into the band, flipping it the right way up. Returns false if
+// its readback isn't complete and we shouldn't wait for it.
+static bool drain_oldest(tiler_t *tiler, bool wait) {
+    int index = tiler->drained % TILER_RING;
+    slot_t *slot = &tiler->slots[index];
+    
+    double start = timer_now();
+    if(!gl_wait_fence(&slot->fence, wait)) return false;
+    
+    double ready = timer_now();
+    tiler->wait_ms += (ready - start) * 1e3;
+    
+    const tile_t *tile = &slot->tile;
+    size_t tile_pitch = (size_t)tile->width * 4;
+    size_t band_pitch = (size_t)tiler->width * 4;
+    const uint8_t *pixels = tiler->mapped ? tiler->mapped + index * tiler->slot_size : NULL;
+    if(!pixels) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, tiler->pbo);
+        pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, index * tiler->slot_size,
+                                  tile_pitch * tile->height, GL_MAP_READ_BIT);
+        if(!pixels) die("could not map tile readback buffer");
+    }
+    for(int y = 0; y < tile->height; ++y) {
+        uint8_t *dst = tiler->band + (size_t)(tile->height - 1 - y) * band_pitch + (size_t)tile->x * 4;
+        memcpy(dst, pixels + y * tile_pitch, tile_pitch);
+    }
+    if(!tiler->mapped) {
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    
+    // Tiles come in left to right, so the rightmost one completes the band.
+    if(tile->x + tile->width == tiler->width) write_band(tiler, tile->height);
+    tiler->drained += 1;
+    tiler->write_ms += (timer_now() - ready) * 1e3;
+    return true;
+}
+
+bool tiler_read(tiler_t *tiler, GLuint fbo) {
+    assert(tiler);
+    
+    while(tiler->drained < tiler->queued && drain_oldest(tiler, false)) {}
+    if(tiler->queued - tiler->drained == TILER_RING) drain_oldest(tiler, true);
+    
+    int index = tiler->queued % TILER_RING;
+    slot_t *slot = &tiler->slots[index];
+    slot->tile = tiler->current;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, tiler->pbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, slot->tile.width, slot->tile.height, GL_RGBA, GL_UNSIGNED_BYTE,
+                 (void *)(index * tiler->slot_size));
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    tiler->queued += 1;
+    return !tiler->failed;
+}
+
+bool tiler_delete(tiler_t *tiler) {
+    if(!tiler) return true;
+    
+    while(tiler->drained < tiler->queued) drain_oldest(tiler, true);
+    gl_delete_stream_buffer(GL_PIXEL_PACK_BUFFER, tiler->pbo, tiler->mapped);
+    
+    bool ok = !tiler->failed;
+    if(tiler->drained < tiler->total) {
+        fprintf(stderr, "only %ld of %ld tiles of `%s` were rendered\n", tiler->drained, tiler->total, tiler->path);
+        ok = false;
+    }
+    if(tiler->png) {
+        ok = png_stream_end(tiler->png) && ok;
+    } else if(fclose(tiler->ppm)) {
+        write_failed(tiler);
+        ok = false;
+    }
+    
+    if(ok) {
+        fprintf(stderr, "saved %dx%d image to `%s` in %.2f s: %.1f ms waiting on readback, "
+                "%.1f ms writing\n", tiler->width, tiler->height, tiler->path,
+                timer_now() - tiler->start, tiler->wait_ms, tiler->write_ms);
+    }
+    free(tiler->band);
+    free(tiler->row);
+    free(tiler->path);
+    free(tiler);
+    return ok;
+}
@@ -0,0 +1,46 @@
+//===--------------------------------------------------------------------------------------------===
+// tiler.h - Tiled rendering of images larger than a render target
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include "gl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tiler_t tiler_t;
+
+// A tile's place in the image, in pixels from the top-left corner.
+typedef struct {
+    int     x;
+    int     y;
+    int     width;
+    int     height;
+} tile_t;
+
+// Starts writing a `width`x`height` image to `path`, as a PNG if it ends in `.png` and a PPM
+// otherwise, from tiles of at most `tile_size` pixels square. Only one row of tiles is ever held in
+// memory. Returns NULL if the file can't be opened.
+tiler_t *tiler_new(const char *path, int width, int height, int tile_size);
+
+// Gets the next tile to render, top row first and left to right. Returns false once every tile
+// was handed out.
+bool tiler_next(tiler_t *tiler, tile_t *tile);
+
+// Queues the readback of the tile last returned by tiler_next(), rendered at the bottom-left of
+// `fbo`. Rows of tiles are written out as soon as all their readbacks have completed; this only
+// blocks when the ring of readback buffers is full. Changes the read framebuffer binding.
+bool tiler_read(tiler_t *tiler, GLuint fbo);
+
+// Writes out the remaining tiles and closes the file. Returns false if any write failed, or if
+// some tiles were never read back.
+bool tiler_delete(tiler_t *tiler);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,111 @@
+//===--------------------------------------------------------------------------------------------===
+// timer.c - GPU timer queries that don't stall the pipeline
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "timer.h"
+#include <assert.h>
+#include <time.h>
+
+void gpu_timer_init(gpu_timer_t *timer) {
+    assert(timer);
+    *timer = (gpu_timer_t){0};
+    glGenQueries(GPU_TIMER_RING, timer->frame_start);
+    glGenQueries(GPU_TIMER_RING, timer->frame_end);
+    glGenQueries(GPU_TIMER_RING, timer->draw);
+}
+
+void gpu_timer_fini(gpu_timer_t *timer) {
+    assert(timer);
+    glDeleteQueries(GPU_TIMER_RING, timer->frame_start);
+    glDeleteQueries(GPU_TIMER_RING, timer->frame_end);
+    glDeleteQueries(GPU_TIMER_RING, timer->draw);
+}
+
+void gpu_timer_begin_frame(gpu_timer_t *timer, long frame) {
+    assert(timer && !timer->in_frame);
+    
+    // If the GPU is so far behind that we'd overwrite a query that hasn't been read back yet, we
+    // don't measure this frame at all rather than wait.
+    timer->skipped = timer->head - timer->tail >= GPU_TIMER_RING;
+    if(timer->skipped) {
+        timer->dropped += 1;
+        return;
+    }
+    
+    unsigned slot = timer->head % GPU_TIMER_RING;
+    timer->frame[slot] = frame;
+    timer->has_draw[slot] = false;
+    timer->in_frame = true;
+    glQueryCounter(timer->frame_start[slot], GL_TIMESTAMP);
+}
+
+void gpu_timer_end_frame(gpu_timer_t *timer) {
+    assert(timer);
+    if(!timer->in_frame) return;
+    assert(!timer->in_draw);
+    
+    unsigned slot = timer->head % GPU_TIMER_RING;
+    glQueryCounter(timer->frame_end[slot], GL_TIMESTAMP);
+    timer->in_frame = false;
+    timer->head += 1;
+}
+
+void gpu_timer_begin_draw(gpu_timer_t *timer) {
+    assert(timer);
+    if(!timer->in_frame) return;
+    
+    unsigned slot = timer->head % GPU_TIMER_RING;
+    // Only one GL_TIME_ELAPSED query can be active at once, so only the first draw of a frame is
+    // measured on its own. The frame timestamps still cover everything.
+    if(timer->has_draw[slot]) return;
+    timer->has_draw[slot] = true;
+    timer->in_draw = true;
+    glBeginQuery(GL_TIME_ELAPSED, timer->draw[slot]);
+}
+
+void gpu_timer_end_draw(gpu_timer_t *timer) {
+    assert(timer);
+    if(!timer->in_draw) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    timer->in_draw = false;
+}
+
+bool gpu_timer_poll(gpu_timer_t *timer, gpu_sample_t *sample, bool wait) {
+    assert(timer);
+    assert(sample);
+    if(timer->tail == timer->head) return false;
+    
+    unsigned slot = timer->tail % GPU_TIMER_RING;
+    if(!wait) {
+        // Queries complete in order, so the end timestamp being there means the rest is too.
+        GLint available = 0;
+        glGetQueryObjectiv(timer->frame_end[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available) return false;
+    }
+    
+    GLuint64 start = 0, end = 0, draw = 0;
+    glGetQueryObjectui64v(timer->frame_start[slot], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(timer->frame_end[slot], GL_QUERY_RESULT, &end);
+    if(timer->has_draw[slot]) {
+        glGetQueryObjectui64v(timer->draw[slot], GL_QUERY_RESULT, &draw);
+    }
+    
+    sample->frame = timer->frame[slot];
+    sample->frame_ms = (double)(end - start) * 1e-6;
+    sample->draw_ms = timer->has_draw[slot] ? (double)draw * 1e-6 : NAN;
+    // Some drivers lose the start of an elapsed-time query when the render target's size changes
+    // while it runs, and report the raw end timestamp instead. A draw can't outlast its own frame.
+    if(sample->draw_ms > sample->frame_ms) sample->draw_ms = NAN;
+    timer->tail += 1;
+    return true;
+}
+
+double timer_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
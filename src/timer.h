@@ -0,0 +1,60 @@
+//===--------------------------------------------------------------------------------------------===
+// timer.h - GPU timer queries that don't stall the pipeline
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include "gl.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Results are only read back once the GPU is done with them, which is usually 2-3 frames after
+// they were issued. The ring must be deep enough to cover that latency, or frames get dropped
+// from the measurements (never waited on).
+#define GPU_TIMER_RING 8
+
+typedef struct {
+    GLuint      frame_start[GPU_TIMER_RING];
+    GLuint      frame_end[GPU_TIMER_RING];
+    GLuint      draw[GPU_TIMER_RING];
+    long        frame[GPU_TIMER_RING];
+    bool        has_draw[GPU_TIMER_RING];
+    
+    uint64_t    head;       // next slot to issue
+    uint64_t    tail;       // oldest slot not read back yet
+    bool        in_frame;
+    bool        in_draw;
+    bool        skipped;
+    long        dropped;
+} gpu_timer_t;
+
+typedef struct {
+    long        frame;
+    double      frame_ms;   // GL_TIMESTAMP delta between frame begin and end
+    double      draw_ms;    // GL_TIME_ELAPSED around the screen pass's draw, NAN if none
+} gpu_sample_t;
+
+void gpu_timer_init(gpu_timer_t *timer);
+void gpu_timer_fini(gpu_timer_t *timer);
+
+void gpu_timer_begin_frame(gpu_timer_t *timer, long frame);
+void gpu_timer_end_frame(gpu_timer_t *timer);
+void gpu_timer_begin_draw(gpu_timer_t *timer);
+void gpu_timer_end_draw(gpu_timer_t *timer);
+
+// Reads back the oldest pending frame if its results are available. With `wait`, blocks until they
+// are, which should only be done when draining at exit.
+bool gpu_timer_poll(gpu_timer_t *timer, gpu_sample_t *sample, bool wait);
+
+// Monotonic wall clock in seconds, for CPU-side timing.
+double timer_now(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
@@ -0,0 +1,271 @@
+//===--------------------------------------------------------------------------------------------===
+// upload.c - Streaming texture uploads through pixel buffer objects
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "upload.h"
+#include "timer.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define UPLOAD_MAX_SLOTS 8
+
+typedef struct upload_t {
+    struct upload_t *next;
+    int             id;
+    unsigned        generation;
+    gl_image_t      image;
+    GLuint          tex;
+    bool            in_place;   // `tex` belongs to the caller
+    int             level;      // level being transferred
+    int             row;        // next row of that level to transfer
+    double          upload_ms;
+    int             steps;
+    long            last_step;
+} upload_t;
+
+struct uploader_t {
+    GLuint          pbo;
+    uint8_t         *mapped;    // persistent mapping, or NULL
+    size_t          slot_size;
+    int             slots;
+    int             next;
+    GLsync          fences[UPLOAD_MAX_SLOTS];
+    long            step;
+    
+    upload_t        *head;
+    upload_t        *tail;
+};
+
+uploader_t *uploader_new(int slots, size_t slot_size) {
+    assert(slots > 0 && slots <= UPLOAD_MAX_SLOTS);
+    assert(slot_size > 0);
+    
+    uploader_t *uploader = calloc(1, sizeof(uploader_t));
+    uploader->slots = slots;
+    uploader->slot_size = slot_size;
+    GLsizeiptr size = (GLsizeiptr)(slots * slot_size);
+    
+    void *mapped = NULL;
+    uploader->pbo = gl_create_stream_buffer(GL_PIXEL_UNPACK_BUFFER, size, GL_MAP_WRITE_BIT, &mapped);
+    uploader->mapped = mapped;
+    
+    fprintf(stderr, "upload: %d x %zu KiB staging buffers%s\n",
+            slots, slot_size / 1024, uploader->mapped ? ", persistently mapped" : "");
+    return uploader;
+}
+
+static void discard(upload_t *upload) {
+    if(upload->tex && !upload->in_place) glDeleteTextures(1, &upload->tex);
+    gl_free_image(&upload->image);
+    free(upload);
+}
+
+void uploader_delete(uploader_t *uploader) {
+    if(!uploader) return;
+    
+    while(uploader->head) {
+        upload_t *upload = uploader->head;
+        uploader->head = upload->next;
+        discard(upload);
+    }
+    for(int i = 0; i < uploader->slots; ++i) {
+        if(uploader->fences[i]) glDeleteSync(uploader->fences[i]);
+    }
+    gl_delete_stream_buffer(GL_PIXEL_UNPACK_BUFFER, uploader->pbo, uploader->mapped);
+    free(uploader);
+}
+
+void uploader_start(uploader_t *uploader, int id, unsigned generation, gl_image_t *image, GLuint tex) {
+    assert(uploader);
+    assert(image && image->pixels);
+    
+    for(upload_t **link = &uploader->head; *link;) {
+        upload_t *upload = *link;
+        if(upload->id != id) {
+            link = &upload->next;
+            continue;
+        }
+        *link = upload->next;
+        discard(upload);
+    }
+    uploader->tail = NULL;
+    for(upload_t *upload = uploader->head; upload; upload = upload->next) uploader->tail = upload;
+    
+    upload_t *upload = calloc(1, sizeof(upload_t));
+    upload->id = id;
+    upload->generation = generation;
+    upload->image = *image;
+    upload->tex = tex;
+    upload->in_place = tex != 0;
+    upload->last_step = -1;
+    image->pixels = NULL;
+    image->mapping = NULL;
+    
+    if(uploader->tail) uploader->tail->next = upload;
+    else uploader->head = upload;
+    uploader->tail = upload;
+}
+
+bool uploader_busy(const uploader_t *uploader) {
+    assert(uploader);
+    return uploader->head != NULL;
+}
+
+// Waits until the GPU is done reading from the next staging slot. Returns false if it isn't and
+// we shouldn't wait.
+static bool acquire_slot(uploader_t *uploader, bool wait) {
+    return gl_wait_fence(&uploader->fences[uploader->next], wait);
+}
+
+// Compressed levels are transferred in rows of 4x4 blocks rather than rows of texels.
+static int row_height(const gl_image_t *image) {
+    return gl_block_size(image->internal) ? 4 : 1;
+}
+
+static size_t level_pitch(const gl_image_t *image, int width) {
+    size_t block = gl_block_size(image->internal);
+    if(block) return (size_t)((width + 3) / 4) * block;
+    return gl_image_pitch(image) / image->width * width;
+}
+
+// Transfers `rows` rows of the current level, starting at the upload's row, from `data`: either
+// client memory or an offset into the bound unpack buffer.
+static void sub_image(const upload_t *upload, int rows, const void *data) {
+    const gl_image_t *image = &upload->image;
+    int width, height;
+    gl_image_level(image, upload->level, &width, &height);
+    int y = upload->row * row_height(image);
+    int h = rows * row_height(image);
+    if(h > height - y) h = height - y;
+    
+    if(gl_block_size(image->internal)) {
+        GLsizei size = (GLsizei)(level_pitch(image, width) * rows);
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, upload->level, 0, y, width, h, image->internal, size, data);
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, upload->level, 0, y, width, h, gl_image_format(image), image->type, data);
+    }
+}
+
+// Copies rows [row, row + rows) into the next staging slot, and queues their transfer.
+static void transfer_band(uploader_t *uploader, upload_t *upload, int rows) {
+    const gl_image_t *image = &upload->image;
+    int width;
+    const uint8_t *pixels = gl_image_level(image, upload->level, &width, NULL);
+    size_t pitch = level_pitch(image, width);
+    size_t size = pitch * rows;
+    size_t offset = uploader->next * uploader->slot_size;
+    const uint8_t *src = pixels + pitch * upload->row;
+    
+    if(uploader->mapped) {
+        memcpy(uploader->mapped + offset, src, size);
+    } else {
+        void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size,
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if(!dst) die("could not map texture staging buffer");
+        memcpy(dst, src, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    
+    sub_image(upload, rows, (const void *)offset);
+    uploader->fences[uploader->next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    uploader->next = (uploader->next + 1) % uploader->slots;
+    upload->row += rows;
+}
+
+bool uploader_step(uploader_t *uploader, size_t *budget, bool wait, upload_done_t *done) {
+    assert(uploader);
+    assert(budget);
+    assert(done);
+    
+    upload_t *upload = uploader->head;
+    if(!upload) {
+        uploader->step += 1;
+        return false;
+    }
+    
+    const gl_image_t *image = &upload->image;
+    double start = timer_now();
+    if(upload->last_step != uploader->step) {
+        upload->last_step = uploader->step;
+        upload->steps += 1;
+    }
+    
+    if(!upload->tex) {
+        gl_image_t storage = *image;
+        storage.pixels = NULL;
+        upload->tex = gl_alloc_tex(&storage, 0);
+    } else {
+        glBindTexture(GL_TEXTURE_2D, upload->tex);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    
+    // A texture refreshed in place is live, so it can't be left half-written between frames: its
+    // upload ignores the budget and goes through in one step.
+    if(upload->in_place) wait = true;
+    
+    // Every level the image carries is streamed, one after the other. Compressed levels go in rows of
+    // blocks.
+    while(upload->level < image->levels) {
+        int width, height;
+        const uint8_t *pixels = gl_image_level(image, upload->level, &width, &height);
+        size_t pitch = level_pitch(image, width);
+        int count = (height + row_height(image) - 1) / row_height(image);
+        
+        if(pitch > uploader->slot_size) {
+            // Rows too wide to stage go straight from client memory, one at a time.
+            while(upload->row < count && (*budget >= pitch || wait)) {
+                sub_image(upload, 1, pixels + pitch * upload->row);
+                upload->row += 1;
+                *budget = *budget > pitch ? *budget - pitch : 0;
+            }
+        } else {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploader->pbo);
+            while(upload->row < count) {
+                int rows = (int)(uploader->slot_size / pitch);
+                if(rows > count - upload->row) rows = count - upload->row;
+                if(!wait && *budget < pitch * rows) {
+                    rows = (int)(*budget / pitch);
+                    if(!rows) break;
+                }
+                if(!acquire_slot(uploader, wait)) break;
+                transfer_band(uploader, upload, rows);
+                size_t sent = pitch * rows;
+                *budget = *budget > sent ? *budget - sent : 0;
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        
+        if(upload->row < count) break;
+        upload->level += 1;
+        upload->row = 0;
+    }
+    upload->upload_ms += (timer_now() - start) * 1e3;
+    
+    if(upload->level < image->levels) {
+        uploader->step += 1;
+        return false;
+    }
+    // Images without a full chain get the rest generated. Compressed images always have one.
+    if(image->levels < gl_mip_levels(image->width, image->height)) glGenerateMipmap(GL_TEXTURE_2D);
+    
+    done->id = upload->id;
+    done->generation = upload->generation;
+    done->tex = upload->tex;
+    done->width = image->width;
+    done->height = image->height;
+    done->internal = image->internal;
+    done->upload_ms = upload->upload_ms;
+    done->steps = upload->steps;
+    
+    uploader->head = upload->next;
+    if(!uploader->head) uploader->tail = NULL;
+    upload->tex = 0;
+    discard(upload);
+    return true;
+}
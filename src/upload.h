@@ -0,0 +1,56 @@
+//===--------------------------------------------------------------------------------------------===
+// upload.h - Streaming texture uploads through pixel buffer objects
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include "gl.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct uploader_t uploader_t;
+
+typedef struct {
+    int         id;
+    unsigned    generation;
+    GLuint      tex;        // owned by the caller from now on
+    int         width;
+    int         height;
+    GLenum      internal;   // storage format
+    double      upload_ms;  // CPU time spent copying and issuing transfers
+    int         steps;      // number of uploader_step() calls the transfer was spread over
+} upload_done_t;
+
+// Creates an uploader with a ring of `slots` staging areas of `slot_size` bytes each. They are
+// persistently mapped when the driver has ARB_buffer_storage, and mapped per band otherwise.
+uploader_t *uploader_new(int slots, size_t slot_size);
+
+// Deletes the textures of unfinished uploads.
+void uploader_delete(uploader_t *uploader);
+
+// Queues `image` to be streamed into a new texture with a full mip chain. Every level the image has
+// is streamed, and missing ones are generated once those are in. The uploader takes ownership of
+// the pixels.
+// With a `tex`, the image is streamed into that texture instead, which must have been created for
+// an image with the same size and internal format. It stays owned by the caller, and since it may be
+// in use, it's written in a single uploader_step() call, whatever the budget.
+// An unfinished upload with the same `id` is cancelled.
+void uploader_start(uploader_t *uploader, int id, unsigned generation, gl_image_t *image, GLuint tex);
+
+bool uploader_busy(const uploader_t *uploader);
+
+// Transfers up to `*budget` bytes of queued images, in bands of rows, and takes what was sent off
+// the budget. Returns true and fills `done` when an upload completes; call again until it returns
+// false. Without `wait`, stops early rather than block on a staging area the GPU is still reading.
+// Changes the texture binding of the active unit.
+bool uploader_step(uploader_t *uploader, size_t *budget, bool wait, upload_done_t *done);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
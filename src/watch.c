@@ -0,0 +1,207 @@
+//===--------------------------------------------------------------------------------------------===
+// watch.c - File change notifications for automatic reloads
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#include "watch.h"
+#include "hash.h"
+#include "timer.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+// How long a file must stay untouched before we look at it. Editors often truncate, write and
+// rename in several steps; reading in the middle of that would give us a half-saved file.
+#define WATCH_DEBOUNCE  0.1
+// Without inotify, how often we stat() the files.
+#define WATCH_INTERVAL  0.25
+
+typedef struct {
+    char        *path;
+    const char  *name;      // points into path
+    int         wd;
+    uint64_t    hash;
+    
+    bool        touched;
+    double      last_event;
+    bool        changed;
+    
+    // Polling fallback
+    time_t      mtime;
+    off_t       size;
+} watched_file_t;
+
+struct watch_t {
+    int             fd;
+    watched_file_t  *files;
+    int             count;
+    int             capacity;
+    double          last_scan;
+};
+
+uint64_t watch_hash_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if(!f) return 0;
+    
+    uint64_t hash = HASH_INIT;
+    uint8_t buffer[64 * 1024];
+    size_t n = 0;
+    while((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        hash = hash_bytes(hash, buffer, n);
+    }
+    fclose(f);
+    return hash;
+}
+
+watch_t *watch_new(void) {
+    watch_t *watch = calloc(1, sizeof(*watch));
+    watch->fd = -1;
+#ifdef __linux__
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(watch->fd < 0) fprintf(stderr, "watch: inotify unavailable, polling files instead\n");
+#endif
+    watch->last_scan = timer_now();
+    return watch;
+}
+
+void watch_delete(watch_t *watch) {
+    if(!watch) return;
+#ifdef __linux__
+    if(watch->fd >= 0) close(watch->fd);
+#endif
+    for(int i = 0; i < watch->count; ++i) free(watch->files[i].path);
+    free(watch->files);
+    free(watch);
+}
+
+int watch_add(watch_t *watch, const char *path) {
+    assert(watch);
+    assert(path);
+    
+    if(watch->count == watch->capacity) {
+        watch->capacity = watch->capacity ? watch->capacity * 2 : 8;
+        watch->files = realloc(watch->files, watch->capacity * sizeof(watched_file_t));
+    }
+    
+    watched_file_t *file = &watch->files[watch->count];
+    *file = (watched_file_t){0};
+    file->path = strdup(path);
+    file->wd = -1;
+    
+    char *sep = strrchr(file->path, '/');
+    file->name = sep ? sep + 1 : file->path;
+    file->hash = watch_hash_file(path);
+    
+    struct stat st;
+    if(!stat(path, &st)) {
+        file->mtime = st.st_mtime;
+        file->size = st.st_size;
+    }
+    
+#ifdef __linux__
+    if(watch->fd >= 0) {
+        // We watch the directory rather than the file: editors that save by writing a new file and
+        // renaming it over the old one would otherwise leave us watching a deleted inode.
+        const char *dir = ".";
+        char buffer[strlen(path) + 1];
+        if(sep) {
+            memcpy(buffer, file->path, sep - file->path);
+            buffer[sep - file->path] = '\0';
+            dir = sep == file->path ? "/" : buffer;
+        }
+        file->wd = inotify_add_watch(watch->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MODIFY);
+        if(file->wd < 0) {
+            fprintf(stderr, "watch: could not watch `%s`: %s\n", dir, strerror(errno));
+        }
+    }
+#endif
+    
+    return watch->count++;
+}
+
+static void touch(watched_file_t *file, double now) {
+    file->touched = true;
+    file->last_event = now;
+}
+
+#ifdef __linux__
+static void read_events(watch_t *watch, double now) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for(;;) {
+        ssize_t len = read(watch->fd, buffer, sizeof(buffer));
+        if(len <= 0) break;
+        
+        for(char *p = buffer; p < buffer + len;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if(!event->len) continue;
+            
+            for(int i = 0; i < watch->count; ++i) {
+                watched_file_t *file = &watch->files[i];
+                if(file->wd == event->wd && !strcmp(file->name, event->name)) touch(file, now);
+            }
+        }
+    }
+}
+#endif
+
+static void scan_files(watch_t *watch, double now) {
+    if(now - watch->last_scan < WATCH_INTERVAL) return;
+    watch->last_scan = now;
+    
+    for(int i = 0; i < watch->count; ++i) {
+        watched_file_t *file = &watch->files[i];
+        if(file->wd >= 0) continue;
+        
+        struct stat st;
+        if(stat(file->path, &st)) continue;
+        if(st.st_mtime == file->mtime && st.st_size == file->size) continue;
+        file->mtime = st.st_mtime;
+        file->size = st.st_size;
+        touch(file, now);
+    }
+}
+
+bool watch_poll(watch_t *watch) {
+    assert(watch);
+    double now = timer_now();
+    
+#ifdef __linux__
+    if(watch->fd >= 0) read_events(watch, now);
+#endif
+    scan_files(watch, now);
+    
+    bool any = false;
+    for(int i = 0; i < watch->count; ++i) {
+        watched_file_t *file = &watch->files[i];
+        if(!file->touched || now - file->last_event < WATCH_DEBOUNCE) continue;
+        file->touched = false;
+        
+        // Touching a file, or saving it without changes, isn't worth a reload.
+        uint64_t hash = watch_hash_file(file->path);
+        if(!hash || hash == file->hash) continue;
+        file->hash = hash;
+        file->changed = true;
+        any = true;
+    }
+    return any;
+}
+
+bool watch_changed(watch_t *watch, int id) {
+    assert(watch);
+    if(id < 0 || id >= watch->count) return false;
+    bool changed = watch->files[id].changed;
+    watch->files[id].changed = false;
+    return changed;
+}
@@ -0,0 +1,38 @@
+//===--------------------------------------------------------------------------------------------===
+// watch.h - File change notifications for automatic reloads
+//
+// Created by Amy Parent <amy@amyparent.com>
+// Copyright (c) 2022 Amy Parent
+// Licensed under the MIT License
+// =^•.•^=
+//===--------------------------------------------------------------------------------------------===
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct watch_t watch_t;
+
+watch_t *watch_new(void);
+void watch_delete(watch_t *watch);
+
+// Starts watching a file. Returns an id for watch_changed(), or -1 on error.
+int watch_add(watch_t *watch, const char *path);
+
+// Processes pending file events without blocking. A file only counts as changed once it has been
+// quiet for a short while (so the several writes of a single editor save are coalesced), and its
+// contents hash differently from the last version we saw. Returns true if any file changed.
+bool watch_poll(watch_t *watch);
+
+// Whether the file changed in the last watch_poll(). Clears the flag.
+bool watch_changed(watch_t *watch, int id);
+
+// Hash of a file's contents, or 0 if it can't be read.
+uint64_t watch_hash_file(const char *path);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif